@@ -0,0 +1,163 @@
+/*
+ * Checkpoint.cpp
+ *
+ *  The file is the magic string, the number of entries, then for each a
+ *  type byte, the length of the name and the name; a 'd' entry then has the
+ *  number of values and the values, an 's' entry the length of a string and
+ *  its bytes. The description of the run (model, data and options) is kept
+ *  as 's' entries "run:[what]".
+ */
+
+#include "Checkpoint.h"
+#include <cstdio>
+using namespace std;
+
+// first bytes of a checkpoint file (the numbers in it are in the byte order of the machine)
+static const char CKPT_MAGIC[] = "FGWASCK2";
+
+Checkpoint::Checkpoint(){
+	params = NULL;
+	enabled = false;
+	lastwrite = 0;
+}
+
+void Checkpoint::init(Fgwas_params* p, const map<string, string>& run){
+	params = p;
+	enabled = p->checkpoint_sec > 0 || p->timelimit > 0 || p->resume;
+	file = p->outstem+".ckpt";
+	lastwrite = time(NULL);
+	entries.clear();
+	texts.clear();
+	if (!enabled) return;
+	if (p->resume){
+		read();
+		for (map<string, string>::const_iterator it = run.begin(); it != run.end(); it++){
+			map<string, string>::iterator saved_it = texts.find("run:"+it->first);
+			if (saved_it == texts.end()){
+				cerr << "ERROR: checkpoint "<< file << " has no "<< it->first << " to compare with this run\n";
+				exit(1);
+			}
+			const string& saved = saved_it->second;
+			if (saved != it->second){
+				cerr << "ERROR: checkpoint "<< file << " is from a run with different "<< it->first << "\n";
+				cerr << "  checkpoint: "<< saved << "\n";
+				cerr << "  this run:   "<< it->second << "\n";
+				exit(1);
+			}
+		}
+		cout << "Resuming from "<< file << " ("<< entries.size() << " saved steps)\n";
+	}
+	texts.clear();
+	for (map<string, string>::const_iterator it = run.begin(); it != run.end(); it++) texts["run:"+it->first] = it->second;
+}
+
+bool Checkpoint::has(const string& key){
+	return entries.find(key) != entries.end();
+}
+
+const vector<double>& Checkpoint::get(const string& key){
+	return entries[key];
+}
+
+void Checkpoint::put(const string& key, const vector<double>& val){
+	entries[key] = val;
+	if (enabled) write();
+}
+
+void Checkpoint::erase(const string& key){
+	entries.erase(key);
+}
+
+bool Checkpoint::due(){
+	return enabled && params->checkpoint_sec > 0 && difftime(time(NULL), lastwrite) >= params->checkpoint_sec;
+}
+
+bool Checkpoint::out_of_time(){
+	return params && params->timelimit > 0 && difftime(time(NULL), params->start_time) >= params->timelimit;
+}
+
+void Checkpoint::read(){
+	ifstream in(file.c_str(), ios::binary);
+	if (!in){
+		cerr << "ERROR: cannot open checkpoint "<< file << "\n";
+		exit(1);
+	}
+	in.seekg(0, ios::end);
+	long size = in.tellg();
+	in.seekg(0, ios::beg);
+	char magic[8];
+	in.read(magic, 8);
+	if (!in || string(magic, 8) != string(CKPT_MAGIC, 8)){
+		cerr << "ERROR: "<< file << " is not an fgwas checkpoint of this version\n";
+		exit(1);
+	}
+	int n = 0;
+	in.read((char*) &n, sizeof(int));
+	if (in && n < 0) corrupt();
+	for (int i = 0; i < n && in; i++){
+		char type = 0;
+		in.get(type);
+		int len = 0;
+		in.read((char*) &len, sizeof(int));
+		if (!in) break;
+		if ((type != 'd' && type != 's') || len < 0 || len > 1000) corrupt();
+		string key(len, ' ');
+		if (len > 0) in.read(&key[0], len);
+		int nval = 0;
+		in.read((char*) &nval, sizeof(int));
+		if (!in) break;
+		// counts are checked against the rest of the file before anything is allocated
+		long width = type == 'd' ? sizeof(double) : 1;
+		if (nval < 0 || nval * width > size - (long) in.tellg()) corrupt();
+		if (type == 's'){
+			string& val = texts[key];
+			val.resize(nval);
+			if (nval > 0) in.read(&val[0], nval);
+			continue;
+		}
+		vector<double>& val = entries[key];
+		val.resize(nval);
+		if (nval > 0) in.read((char*) &val[0], nval*sizeof(double));
+	}
+	if (!in){
+		cerr << "ERROR: checkpoint "<< file << " is truncated\n";
+		exit(1);
+	}
+}
+
+void Checkpoint::corrupt(){
+	cerr << "ERROR: checkpoint "<< file << " is corrupt\n";
+	exit(1);
+}
+
+void Checkpoint::write(){
+	string tmp = file+".tmp";
+	ofstream out(tmp.c_str(), ios::binary);
+	out.write(CKPT_MAGIC, 8);
+	int n = texts.size() + entries.size();
+	out.write((char*) &n, sizeof(int));
+	for (map<string, string>::iterator it = texts.begin(); it != texts.end(); it++){
+		int len = it->first.size();
+		int nval = it->second.size();
+		out.put('s');
+		out.write((char*) &len, sizeof(int));
+		out.write(it->first.data(), len);
+		out.write((char*) &nval, sizeof(int));
+		out.write(it->second.data(), nval);
+	}
+	for (map<string, vector<double> >::iterator it = entries.begin(); it != entries.end(); it++){
+		int len = it->first.size();
+		int nval = it->second.size();
+		out.put('d');
+		out.write((char*) &len, sizeof(int));
+		out.write(it->first.data(), len);
+		out.write((char*) &nval, sizeof(int));
+		if (nval > 0) out.write((char*) &it->second[0], nval*sizeof(double));
+	}
+	out.close();
+	if (!out || rename(tmp.c_str(), file.c_str()) != 0){
+		cerr << "WARNING: could not write checkpoint "<< file << "\n";
+		return;
+	}
+	lastwrite = time(NULL);
+}
@@ -0,0 +1,39 @@
+/*
+ * Checkpoint.h
+ *
+ *  Named vectors of doubles and strings saved to [stem].ckpt, so that a run
+ *  stopped by -timelimit (or killed) can be continued with -resume.
+ */
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include "fgwas_params.h"
+using namespace std;
+
+// -checkpoint, -resume and -timelimit: the results of the finished steps of a run and the state of
+// the optimizer in progress, by name, in outstem.ckpt. The file is written to a temporary name and
+// renamed, so a job stopped while writing it still has the previous one.
+class Checkpoint{
+public:
+	Checkpoint();
+	void init(Fgwas_params*, const map<string, string>& run); // run: what must match on -resume
+	bool has(const string&);
+	const vector<double>& get(const string&);
+	void put(const string&, const vector<double>&); // writes the file
+	void erase(const string&);
+	bool due(); // time for the next periodic write
+	bool out_of_time();
+private:
+	Fgwas_params* params;
+	bool enabled;
+	string file;
+	time_t lastwrite;
+	map<string, vector<double> > entries;
+	map<string, string> texts; // the description of the run
+	void read();
+	void corrupt();
+	void write();
+};
+
+#endif /* CHECKPOINT_H_ */
@@ -0,0 +1,273 @@
+/*
+ * NMSimplex.cpp
+ */
+
+#include "NMSimplex.h"
+#include <algorithm>
+#include <limits>
+using namespace std;
+
+OptimMonitor::OptimMonitor(Fgwas_params* p, int nparam){
+	params = p;
+	maxstuck = p->stuck_iter > 0 ? p->stuck_iter : 2*nparam + 10;
+	numIterationsStuck = 0;
+	lastSize = 0;
+	lastLLK = 0;
+	llks.resize(p->plateau_iter+1);
+}
+
+bool OptimMonitor::stop(int iter, double fval, double size){
+	int P = params->plateau_iter;
+	llks[(iter-1) % (P+1)] = fval;
+	// Stop optimisation if the rate of improvement of LLK is too low
+	if (P > 0 && iter > P) {
+		double llkDiff = abs(llks[(iter-1) % (P+1)] - llks[(iter-1-P) % (P+1)]);
+		// Require that LLK improve at least plateau_llk over the above number of iterations
+		if (llkDiff < params->plateau_llk) {
+			cout << "WARNING: optimization improvement is lower than "<< params->plateau_llk << " unit LLK over "<< P << " iterations. Ending optimization.\n";
+			return true;
+		}
+	}
+	if (fval == lastLLK && size == lastSize) {
+		numIterationsStuck++;
+		if (numIterationsStuck > maxstuck) {
+			cout << "WARNING: optimization stuck at the same values for too many iterations (" << maxstuck << ").\n";
+			cout << "WARNING: failed to converge\n";
+			return true;
+		}
+	} else {
+		numIterationsStuck = 0;
+		lastSize = size;
+		lastLLK = fval;
+	}
+	return false;
+}
+
+NMSimplex::NMSimplex(const vector<double>& x0, const vector<double>& step, Fgwas_params* p) : monitor(p, x0.size()){
+	params = p;
+	nparam = x0.size();
+	// initial simplex: a step along each axis
+	simplex.resize(nparam+1, x0);
+	for (int i = 0; i < nparam; i++) simplex[i+1][i] += step[i];
+	f.resize(nparam+1);
+	centroid.resize(nparam);
+	xr.resize(nparam);
+	xe.resize(nparam);
+	xc.resize(nparam);
+	iterated = done = converged = expanded = outside = false;
+	iter = best = worst = second = 0;
+	size = fr = fe = 0;
+	state = NM_START;
+	ask.reserve(nparam+1);
+	for (int i = 0; i < nparam+1; i++) ask.push_back(i);
+}
+
+const vector<double>& NMSimplex::asked(int i) const{
+	switch (ask[i]){
+	case XR: return xr;
+	case XE: return xe;
+	case XC: return xc;
+	}
+	return simplex[ask[i]];
+}
+
+void NMSimplex::next(){
+	if (iterated){
+		// stopping rules for the iteration just completed
+		iterated = false;
+		if (size < params->optim_tol) converged = true;
+		if (converged || monitor.stop(iter, f[best], size)) {
+			done = true;
+			ask.clear();
+			return;
+		}
+	}
+	if (iter >= params->optim_maxiter) {
+		done = true;
+		ask.clear();
+		return;
+	}
+	iter++;
+	// best and two worst vertices
+	int nv = nparam+1;
+	best = 0;
+	worst = 0;
+	for (int i = 1; i < nv; i++){
+		if (f[i] < f[best]) best = i;
+		if (f[i] > f[worst]) worst = i;
+	}
+	second = best;
+	for (int i = 0; i < nv; i++){
+		if (i != worst && f[i] > f[second]) second = i;
+	}
+	for (int j = 0; j < nparam; j++){
+		double sum = 0;
+		for (int i = 0; i < nv; i++) if (i != worst) sum += simplex[i][j];
+		centroid[j] = sum / (double) nparam;
+		xr[j] = centroid[j] + (centroid[j] - simplex[worst][j]);
+		xe[j] = centroid[j] + 2*(centroid[j] - simplex[worst][j]);
+	}
+	// expansions come in runs, so after one the next expansion point is asked for with the reflection
+	ask.assign(1, XR);
+	if (expanded) ask.push_back(XE);
+	state = NM_REFLECT;
+}
+
+void NMSimplex::tell(const vector<double>& fvals){
+	switch (state){
+	case NM_START:
+		f = fvals;
+		next();
+		return;
+	case NM_REFLECT:
+		fr = fvals[0];
+		if (fvals.size() > 1) fe = fvals[1];
+		else if (fr < f[best]) {
+			ask.assign(1, XE);
+			state = NM_EXPAND;
+			return;
+		}
+		reflected();
+		return;
+	case NM_EXPAND:
+		fe = fvals[0];
+		reflected();
+		return;
+	case NM_CONTRACT:
+		if (fvals[0] < (outside ? fr : f[worst])) {
+			simplex[worst] = xc;
+			f[worst] = fvals[0];
+			end_iteration();
+			return;
+		}
+		// shrink towards the best vertex, all new vertices asked for at once
+		ask.clear();
+		for (int i = 0; i < nparam+1; i++){
+			if (i == best) continue;
+			for (int j = 0; j < nparam; j++) simplex[i][j] = simplex[best][j] + 0.5*(simplex[i][j] - simplex[best][j]);
+			ask.push_back(i);
+		}
+		state = NM_SHRINK;
+		return;
+	case NM_SHRINK:
+		for (int i = 0, k = 0; i < nparam+1; i++){
+			if (i != best) f[i] = fvals[k++];
+		}
+		end_iteration();
+		return;
+	}
+}
+
+void NMSimplex::reflected(){
+	expanded = false;
+	if (fr < f[best]){
+		if (fe < fr) { simplex[worst] = xe; f[worst] = fe; expanded = true; }
+		else { simplex[worst] = xr; f[worst] = fr; }
+	}
+	else if (fr < f[second]) { simplex[worst] = xr; f[worst] = fr; }
+	else {
+		// contract outside the simplex if the reflection helped at all, otherwise inside
+		outside = fr < f[worst];
+		for (int j = 0; j < nparam; j++){
+			if (outside) xc[j] = centroid[j] + 0.5*(xr[j] - centroid[j]);
+			else xc[j] = centroid[j] + 0.5*(simplex[worst][j] - centroid[j]);
+		}
+		ask.assign(1, XC);
+		state = NM_CONTRACT;
+		return;
+	}
+	end_iteration();
+}
+
+void NMSimplex::end_iteration(){
+	int nv = nparam+1;
+	ask.clear();
+	iterated = true;
+	best = 0;
+	for (int i = 1; i < nv; i++) if (f[i] < f[best]) best = i;
+	// size: RMS distance of the vertices from their centre
+	double s2 = 0;
+	for (int j = 0; j < nparam; j++){
+		double c = 0;
+		for (int i = 0; i < nv; i++) c += simplex[i][j];
+		c /= (double) nv;
+		for (int i = 0; i < nv; i++) s2 += (simplex[i][j]-c)*(simplex[i][j]-c);
+	}
+	size = sqrt(s2 / (double) nv);
+}
+
+static void save_vec(vector<double>& out, const vector<double>& v){
+	out.push_back(v.size());
+	out.insert(out.end(), v.begin(), v.end());
+}
+
+static bool restore_vec(const vector<double>& in, int& pos, vector<double>& v){
+	if (pos >= in.size() || pos + 1 + (int) in[pos] > in.size()) return false;
+	int n = (int) in[pos];
+	v.assign(in.begin()+pos+1, in.begin()+pos+1+n);
+	pos += n+1;
+	return true;
+}
+
+void OptimMonitor::save(vector<double>& out){
+	out.push_back(numIterationsStuck);
+	out.push_back(lastSize);
+	out.push_back(lastLLK);
+	save_vec(out, llks);
+}
+
+bool OptimMonitor::restore(const vector<double>& in, int& pos){
+	if (pos + 3 > in.size()) return false;
+	numIterationsStuck = (int) in[pos];
+	lastSize = in[pos+1];
+	lastLLK = in[pos+2];
+	pos += 3;
+	int n = llks.size();
+	return restore_vec(in, pos, llks) && llks.size() == n;
+}
+
+void NMSimplex::save(vector<double>& out){
+	double head[] = {(double) nparam, (double) state, (double) iterated, (double) done, (double) converged, (double) expanded, (double) outside,
+		(double) iter, (double) best, (double) worst, (double) second, size, fr, fe};
+	out.insert(out.end(), head, head + sizeof(head)/sizeof(head[0]));
+	save_vec(out, f);
+	for (int i = 0; i < nparam+1; i++) save_vec(out, simplex[i]);
+	save_vec(out, centroid);
+	save_vec(out, xr);
+	save_vec(out, xe);
+	save_vec(out, xc);
+	out.push_back(ask.size());
+	out.insert(out.end(), ask.begin(), ask.end());
+	monitor.save(out);
+}
+
+bool NMSimplex::restore(const vector<double>& in, int& pos){
+	if (pos + 14 > in.size() || (int) in[pos] != nparam) return false;
+	state = (NMState) (int) in[pos+1];
+	iterated = in[pos+2] != 0;
+	done = in[pos+3] != 0;
+	converged = in[pos+4] != 0;
+	expanded = in[pos+5] != 0;
+	outside = in[pos+6] != 0;
+	iter = (int) in[pos+7];
+	best = (int) in[pos+8];
+	worst = (int) in[pos+9];
+	second = (int) in[pos+10];
+	size = in[pos+11];
+	fr = in[pos+12];
+	fe = in[pos+13];
+	pos += 14;
+	bool ok = restore_vec(in, pos, f);
+	for (int i = 0; i < nparam+1 && ok; i++) ok = restore_vec(in, pos, simplex[i]);
+	ok = ok && restore_vec(in, pos, centroid) && restore_vec(in, pos, xr) && restore_vec(in, pos, xe) && restore_vec(in, pos, xc);
+	if (!ok || pos >= in.size()) return false;
+	int nask = (int) in[pos++];
+	if (nask < 0 || nask > nparam+1 || pos + nask > in.size()) return false;
+	ask.clear();
+	for (int i = 0; i < nask; i++){
+		int a = (int) in[pos++];
+		if (a < XC || a > nparam) return false;
+		ask.push_back(a);
+	}
+	return monitor.restore(in, pos);
+}
@@ -0,0 +1,63 @@
+/*
+ * NMSimplex.h
+ *
+ *  The Nelder-Mead optimizer and the stopping rules it shares with the
+ *  other optimizers. Neither depends on the model: they see only points
+ *  and their values.
+ */
+
+#ifndef NMSIMPLEX_H_
+#define NMSIMPLEX_H_
+
+#include "fgwas_params.h"
+using namespace std;
+
+// stopping rules shared by the optimizers (other than convergence of the simplex)
+class OptimMonitor{
+public:
+	OptimMonitor(Fgwas_params*, int nparam);
+	bool stop(int iter, double fval, double size);
+	void save(vector<double>& out);
+	bool restore(const vector<double>& in, int& pos);
+private:
+	Fgwas_params* params;
+	int maxstuck;
+	int numIterationsStuck;
+	double lastSize, lastLLK;
+	vector<double> llks; // the last plateau_iter+1 values
+};
+
+// Nelder-Mead simplex as a state machine, so that several can be run with their
+// points evaluated together: ask lists the points whose value (-ln(lk)) is needed
+// next, as vertices or XR, XE, XC, and asked(i) is the i-th of them; tell() takes
+// the values. When an iteration is complete, iterated is set and next() applies the
+// stopping rules and starts the following one. Nothing is allocated after the start.
+class NMSimplex{
+public:
+	NMSimplex(const vector<double>& x0, const vector<double>& step, Fgwas_params*);
+	enum {XR = -1, XE = -2, XC = -3};
+	vector<int> ask;
+	const vector<double>& asked(int i) const;
+	void tell(const vector<double>& fvals);
+	void next();
+	void save(vector<double>& out); // appends the whole state, for a checkpoint
+	bool restore(const vector<double>& in, int& pos); // from save(), false if it does not fit
+	bool iterated, done, converged;
+	int iter, best;
+	double size;
+	vector<vector<double> > simplex;
+	vector<double> f;
+private:
+	enum NMState {NM_START, NM_REFLECT, NM_EXPAND, NM_CONTRACT, NM_SHRINK};
+	NMState state;
+	Fgwas_params* params;
+	OptimMonitor monitor;
+	int nparam, worst, second;
+	bool expanded, outside;
+	double fr, fe;
+	vector<double> centroid, xr, xe, xc;
+	void reflected();
+	void end_iteration();
+};
+
+#endif /* NMSIMPLEX_H_ */
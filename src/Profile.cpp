@@ -0,0 +1,181 @@
+/*
+ * Profile.cpp
+ */
+
+#include "Profile.h"
+#include <sys/time.h>
+#include <ctime>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+using namespace std;
+
+double wall_seconds(){
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + 1e-6*now.tv_usec;
+}
+
+Profiler::Profiler(){
+	enabled = false;
+	counters = NULL;
+	spans = NULL;
+	current = -1;
+}
+
+void Profiler::init(bool on, const WorkCounters* c, SpanTracer* t){
+	enabled = on;
+	counters = c;
+	spans = t;
+}
+
+void Profiler::start(const string& phase){
+	if (!enabled && !spans->enabled) return;
+	stop();
+	// a step run again adds to its earlier time
+	current = phases.size();
+	for (int i = 0; i < phases.size(); i++) if (phases[i].name == phase) current = i;
+	if (current == phases.size()){
+		Phase p;
+		p.name = phase;
+		p.wall = 0;
+		p.cpu = 0;
+		phases.push_back(p);
+	}
+	wall0 = wall_seconds();
+	cpu0 = (double) clock() / CLOCKS_PER_SEC;
+	work0 = *counters;
+	span0 = spans->now();
+}
+
+void Profiler::stop(){
+	if (current < 0) return;
+	Phase& p = phases[current];
+	p.wall += wall_seconds() - wall0;
+	p.cpu += (double) clock() / CLOCKS_PER_SEC - cpu0;
+	p.work.llk += counters->llk - work0.llk;
+	p.work.setpriors += counters->setpriors - work0.setpriors;
+	p.work.snps += counters->snps - work0.snps;
+	p.work.explog += counters->explog - work0.explog;
+	spans->add(p.name, span0, spans->now(), -1);
+	current = -1;
+}
+
+static void write_phase(ostream& out, const string& name, double wall, double cpu, const WorkCounters& w){
+	out << "{\"name\": \""<< name << "\", \"wall_sec\": "<< wall << ", \"cpu_sec\": "<< cpu;
+	out << ", \"llk_evals\": "<< w.llk << ", \"set_priors\": "<< w.setpriors << ", \"snps_visited\": "<< w.snps << ", \"exp_log\": "<< w.explog << "}";
+}
+
+void Profiler::write(string file){
+	stop();
+	if (!enabled) return;
+	ofstream out(file.c_str());
+	if (!out){
+		cerr << "WARNING: could not write "<< file << "\n";
+		return;
+	}
+	int nthreads = 1;
+#ifdef _OPENMP
+	nthreads = omp_get_max_threads();
+#endif
+	double wall = 0, cpu = 0;
+	WorkCounters total;
+	out.precision(6);
+	out << fixed;
+	out << "{\n\"threads\": "<< nthreads << ",\n\"phases\": [\n";
+	for (int i = 0; i < phases.size(); i++){
+		const Phase& p = phases[i];
+		out << "  ";
+		write_phase(out, p.name, p.wall, p.cpu, p.work);
+		out << (i+1 < phases.size() ? ",\n" : "\n");
+		wall += p.wall;
+		cpu += p.cpu;
+		total.llk += p.work.llk;
+		total.setpriors += p.work.setpriors;
+		total.snps += p.work.snps;
+		total.explog += p.work.explog;
+	}
+	out << "],\n\"total\": ";
+	write_phase(out, "total", wall, cpu, total);
+	out << "\n}\n";
+}
+
+SpanTracer::SpanTracer(){
+	enabled = false;
+	t0 = 0;
+}
+
+void SpanTracer::init(bool on){
+	enabled = on;
+	if (!enabled) return;
+	int nthreads = 1;
+#ifdef _OPENMP
+	nthreads = omp_get_max_threads();
+#endif
+	threads.resize(nthreads);
+	t0 = wall_seconds();
+}
+
+double SpanTracer::now(){
+	if (!enabled) return 0;
+	return 1e6*(wall_seconds() - t0);
+}
+
+void SpanTracer::add(const string& name, double st, double sp, long arg){
+	if (!enabled) return;
+	int tid = 0;
+	bool nested = false;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+	// inside the teams of parallel -starts, the spans go on the thread of the outer team
+	if (omp_get_level() > 1 && omp_get_team_size(1) > 1){
+		tid = omp_get_ancestor_thread_num(1);
+		nested = true;
+	}
+#endif
+	if (tid >= threads.size()) return;
+	Event e;
+	e.name = name;
+	e.ts = st;
+	e.dur = sp-st;
+	e.arg = arg;
+	if (!nested) {
+		threads[tid].events.push_back(e);
+		return;
+	}
+	#pragma omp critical(span_add)
+	threads[tid].events.push_back(e);
+}
+
+void SpanTracer::write(string file){
+	if (!enabled) return;
+	ofstream out(file.c_str());
+	if (!out){
+		cerr << "WARNING: could not write "<< file << "\n";
+		return;
+	}
+	out.precision(3);
+	out << fixed;
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"fgwas\"}}";
+	for (int t = 0; t < threads.size(); t++){
+		out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "<< t << ", \"args\": {\"name\": \"thread "<< t << "\"}}";
+		const vector<Event>& ev = threads[t].events;
+		for (int i = 0; i < ev.size(); i++){
+			out << ",\n{\"name\": \""<< ev[i].name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "<< t << ", \"ts\": "<< ev[i].ts << ", \"dur\": "<< ev[i].dur;
+			if (ev[i].arg >= 0) out << ", \"args\": {\"n\": "<< ev[i].arg << "}";
+			out << "}";
+		}
+	}
+	out << "\n]}\n";
+}
+
+Span::Span(SpanTracer& t, const char* n, long a) : tracer(t){
+	name = n;
+	arg = a;
+	st = tracer.now();
+}
+
+Span::~Span(){
+	if (tracer.enabled) tracer.add(name, st, tracer.now(), arg);
+}
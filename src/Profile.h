@@ -0,0 +1,86 @@
+/*
+ * Profile.h
+ *
+ *  Timing of a run: -profile (time and work of each step) and
+ *  -chrometrace (spans of work on each thread).
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "fgwas_params.h"
+using namespace std;
+
+// wall-clock time in seconds, to the microsecond
+double wall_seconds();
+
+// -chrometrace: spans of time on each thread, each thread adding to its own buffer (so no locks),
+// written at the end as Chrome trace events (chrome://tracing, ui.perfetto.dev)
+class SpanTracer{
+public:
+	SpanTracer();
+	void init(bool enabled);
+	bool enabled;
+	double now(); // microseconds since init()
+	void add(const string& name, double st, double sp, long arg);
+	void write(string file);
+private:
+	struct Event{
+		string name;
+		double ts, dur;
+		long arg;
+	};
+	struct ThreadEvents{
+		vector<Event> events;
+		char pad[64]; // keep the threads' vectors on separate cache lines
+	};
+	vector<ThreadEvents> threads;
+	double t0;
+};
+
+// a span from construction to destruction, on the calling thread; arg (if >= 0) is shown with it
+class Span{
+public:
+	Span(SpanTracer& t, const char* name, long arg = -1);
+	~Span();
+private:
+	SpanTracer& tracer;
+	const char* name;
+	long arg;
+	double st;
+};
+
+// work in the likelihood code, counted per segment so that the counting does not show in the time
+struct WorkCounters{
+	long llk; // ln(lk) evaluations (each point of a batch, and each EM pass, is one)
+	long setpriors; // set_priors() calls
+	long snps; // SNPs (or annotation patterns) summed over
+	long explog; // exp and log calls in those sums (two per sumlog)
+	WorkCounters() : llk(0), setpriors(0), snps(0), explog(0) {}
+};
+
+// -profile: wall and CPU time (of all threads) of each step of a run, and the work counted in it.
+// With -chrometrace the steps are also spans on the main thread.
+class Profiler{
+public:
+	Profiler();
+	void init(bool enabled, const WorkCounters*, SpanTracer*);
+	void start(const string& phase); // ends the current step
+	void write(string file); // ends the current step
+private:
+	struct Phase{
+		string name;
+		double wall, cpu;
+		WorkCounters work;
+	};
+	bool enabled;
+	const WorkCounters* counters;
+	SpanTracer* spans;
+	vector<Phase> phases;
+	int current; // index in phases, -1 if none
+	double wall0, cpu0, span0;
+	WorkCounters work0;
+	void stop();
+};
+
+#endif /* PROFILE_H_ */
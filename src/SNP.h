@@ -27,40 +27,26 @@
 #include "QuantParams.h"
 using namespace std;
 
+// a bin of a distance model, with its index among all distance annotations
+struct DistBin{
+	int st, sp;
+	int index;
+};
+
 class SNP{
 public:
 	SNP();
-	SNP(string, string, int, int, double, double, vector<double>, vector<bool>, vector<int>, vector<vector<pair<int, int> > >);
-	SNP(string, string, int, int, int, double, double, vector<double>, vector<bool>, vector<int>, vector<vector<pair<int, int> > >);
+	SNP(int, int);
 	//SNP(string, string, int, double, double, double, double, vector<bool>);
-	string id;
-	string chr;
-	int pos;
-	double Z; // Z-score
+	// Z and V are only in SNPs::Z and SNPs::V during the Bayes factor pass, and they and the
+	// identifier are read back from the input file for output (see SNPOutputReader).
+	// The annotations (and -dens and SEGNUMBER) are arrays in SNPs, so a SNP is 16 bytes
 	double BF; // Bayes factor
-	double f; // Minor allele frequency
-	double N; // Sample size
-	double Ncase, Ncontrol; //Sample sizes for case/control study
-	double V; // Variance in estimate of effect size
-	vector<double> W; // Prior variances on effect size (averaged);
-	int chunknumber;
-	float dens;
-	vector<bool> annot;
-	vector<float> annot_weight;
-	vector<int> dists;
-	vector<double> qannot; // a quantitative annotation
-	vector<bool> qannotDefined; // is this quantitative annot defined? (i.e. not NA)
-	
-	bool condannot;
-	void append_distannots(vector<vector<pair<int, int> > >); // convert distances to annotations according to distance models
-	int nannot;
-	double calc_logBF();
-	double calc_logBF_ind(double);
-	double approx_v(); // approximate V using f and N
-	double approx_v_cc(); //approximate V in case control setting
-	double get_x(const vector<double>& lambda, const vector<QuantParams>& qparams);
-	double get_x_cond(const vector<double>& lambda, const vector<QuantParams>& qparams, double lambdac);
-	double sumlog(double, double);
+	int chr; // chromosome code, name is SNPs::chrcodes[chr]
+	int pos;
+	static double approx_v(double f, double N); // approximate V using f and N
+	static double approx_v_cc(double f, double Ncase, double Ncontrol); //approximate V in case control setting
+	static double sumlog(double, double);
 };
 
 
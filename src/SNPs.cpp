@@ -7,16 +7,37 @@
 
 #include "SNPs.h"
 #include <algorithm>
+#include <limits>
+#include <climits>
+#include <cstdio>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 using namespace std;
 
 double FIXED_B1_VAL = 0.0;
 
+// beyond this, the logistic of a quantitative annotation is taken as 0 or 1
+static const double QUANT_THRESH = 4.59512;
+
+// -prune keeps SNPs with a BF within a factor of 1000 of the segment's largest as they are
+static const double PRUNE_KEEP_LBF = log(1000.0);
+
+// input lines read before the SNP arrays are reserved for the whole file
+static const long RESERVE_AFTER = 100000;
+
 inline string strtoupper(string str)
 {
 	std::transform(str.begin(), str.end(), str.begin(), ::toupper);
 	return str;
 }
 
+static bool distbin_lt(const DistBin& a, const DistBin& b){
+	if (a.st != b.st) return a.st < b.st;
+	return a.sp < b.sp;
+}
+
 SNPs::SNPs(){
 
 }
@@ -24,9 +45,25 @@ SNPs::SNPs(){
 SNPs::SNPs(Fgwas_params *p){
 	params = p;
 	params->print_stdout();
+	spans.init(params->chrometrace.size() > 0);
+	prof.init(params->profile, &counters, &spans);
+	prof.start("load");
 
 	//read distance models
 	for (vector<string>::iterator it = params->distmodels.begin(); it != params->distmodels.end(); it++) dmodels.push_back( read_dmodel(*it));
+	ndistannot = 0;
+	for (int i = 0; i < dmodels.size(); i++){
+		vector<DistBin> bins;
+		for (int j = 0; j < dmodels[i].size(); j++){
+			DistBin b;
+			b.st = dmodels[i][j].first;
+			b.sp = dmodels[i][j].second;
+			b.index = ndistannot++;
+			bins.push_back(b);
+		}
+		sort(bins.begin(), bins.end(), distbin_lt);
+		dbins.push_back(bins);
+	}
 
 	//read input file
 	if (params->zformat) {
@@ -36,7 +73,16 @@ SNPs::SNPs(Fgwas_params *p){
 		exit(1);
 	}
 
+	//annotate SNPs in .bed regions
+	for (int i = 0; i < params->bedannot.size(); i++) append_bedannots(params->bedannot[i], params->bedannotfiles[i]);
+
+	//sort (or quantize) quantitative annotations
+	useqbins = params->qbins > 0;
+	if (useqbins) make_qcodes(params->qbins);
+	else make_qindex();
+
 	//make segments
+	prof.start("segments");
 	if (params->finemap) make_segments_finemap();
 	else{
 		make_chrsegments();
@@ -47,15 +93,14 @@ SNPs::SNPs(Fgwas_params *p){
 	check_input();
 
 	//initialize
+	prof.start("setup");
 	snppri.clear();
 	segpi = 0.001;
 	init_segpriors();
     phi = (1+sqrt(5))/2;
     resphi = 2-phi;
-	for (int i = 0; i < d.size(); i++){
-		snppri.push_back(1.0);
-		snppost.push_back(0.0);
-	}
+	snppri.assign(d.size(), 1.0);
+	snppost.assign(d.size(), 0.0);
 	nannot = annotnames.size();
 	nsegannot = segannotnames.size();
 	for (int i = 0; i < nannot; i++)	lambdas.push_back(0);
@@ -68,7 +113,69 @@ SNPs::SNPs(Fgwas_params *p){
 	for (int i = 0; i < quantannotnames.size(); i++) {
 		quantparams.push_back(QuantParams(0, 0, FIXED_B1_VAL));
 	}
+	choose_kernels();
+	make_patterns();
 	set_priors();
+
+	if (params->initfile.size() > 0) read_init(params->initfile);
+	if (params->autoinit) data_init();
+
+	//checkpoint of an earlier run, if resuming
+	timed_out = false;
+	optim_phase = "fit";
+	ckpt.init(params, checkpoint_run());
+	if (params->tracefile.size() > 0) open_trace();
+}
+
+void SNPs::choose_kernels(){
+	// the number of binary and distance annotations is the same for every SNP, so
+	// small counts get a kernel with the loops unrolled
+	int nbinary = nannot - ndistannot;
+	int ndist = dbins.size();
+	snpx_fn = &SNPs::snpx_kernel<-1, -1>;
+	if (ndist == 0){
+		if (nbinary == 0) snpx_fn = &SNPs::snpx_kernel<0, 0>;
+		else if (nbinary == 1) snpx_fn = &SNPs::snpx_kernel<1, 0>;
+		else if (nbinary == 2) snpx_fn = &SNPs::snpx_kernel<2, 0>;
+		else if (nbinary == 3) snpx_fn = &SNPs::snpx_kernel<3, 0>;
+		else if (nbinary == 4) snpx_fn = &SNPs::snpx_kernel<4, 0>;
+	}
+	else if (ndist == 1){
+		if (nbinary == 0) snpx_fn = &SNPs::snpx_kernel<0, 1>;
+		else if (nbinary == 1) snpx_fn = &SNPs::snpx_kernel<1, 1>;
+		else if (nbinary == 2) snpx_fn = &SNPs::snpx_kernel<2, 1>;
+	}
+	if (params->finemap) llk_fn = &SNPs::llk_kernel<true>;
+	else llk_fn = &SNPs::llk_kernel<false>;
+}
+
+template<int NBINARY, int NDIST>
+void SNPs::snpx_kernel(){
+	// x_i from the binary and distance annotations, as in SNP::get_x. NBINARY/NDIST of -1 mean any count.
+	if (lambdas.size() != nannot){
+		cerr << "ERROR: Lambda has "<< lambdas.size()<< " entries. nannot is " << nannot << "\n";
+		exit(1);
+	}
+	int n = d.size();
+	int nbinary = NBINARY >= 0 ? NBINARY : nannot - ndistannot;
+	int ndist = NDIST >= 0 ? NDIST : dbins.size();
+	if (n == 0) return;
+	const double* lambda = lambdas.empty() ? NULL : &lambdas[0];
+	vector<const char*> acol(nbinary);
+	vector<const short*> dcol(ndist);
+	for (int j = 0; j < nbinary; j++) acol[j] = &snpannot[j][0];
+	for (int j = 0; j < ndist; j++) dcol[j] = &snpdistbin[j][0];
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++){
+		double x = 0;
+		for (int j = 0; j < nbinary; j++) {
+			if (acol[j][i]) x += lambda[j];
+		}
+		for (int j = 0; j < ndist; j++) {
+			if (dcol[j][i] >= 0) x += lambda[nbinary+dcol[j][i]];
+		}
+		snppri[i] = x;
+	}
 }
 
 void SNPs::check_input(){
@@ -93,12 +200,12 @@ void SNPs::check_input(){
 		meansize += ((double) toadd/ 1000000.0) / (double) nseg;
 
 		int prevpos = d[st].pos;
-		string prevchr = d[st].chr;
+		int prevchr = d[st].chr;
 		for (int i= st+1; i < sp; i++){
-			string testchr = d[i].chr;
+			int testchr = d[i].chr;
 			int testpos = d[i].pos;
 			if (testchr == prevchr and prevpos >= testpos){  //test that each segment is only a single chromosome, is ordered
-				cerr<< "ERROR: SNPs out of order\nChromosome "<<testchr << ". Position "<< prevpos << " seen before "<< testpos<< "\n";
+				cerr<< "ERROR: SNPs out of order\nChromosome "<<chrcodes[testchr] << ". Position "<< prevpos << " seen before "<< testpos<< "\n";
 				exit(1);
 			}
 			prevpos = testpos;
@@ -141,9 +248,70 @@ vector<pair<int, int> > SNPs::read_dmodel(string infile){
     	}
     	toreturn.push_back(make_pair(start, stop));
     }
+	// a SNP can only fall in one bin
+	vector<pair<int, int> > sorted = toreturn;
+	sort(sorted.begin(), sorted.end());
+	for (int i = 1; i < sorted.size(); i++){
+		if (sorted[i].first < sorted[i-1].second){
+			cerr << "ERROR: in distance model "<< infile << " , bins "<< sorted[i-1].first << " "<< sorted[i-1].second << " and "<< sorted[i].first << " "<< sorted[i].second << " overlap\n";
+			exit(1);
+		}
+	}
 	return toreturn;
 }
 
+void SNPs::append_bedannots(string name, string bedfile){
+	//
+	// SNP is annotated if it falls in one of the regions in the .bed file. Regions are
+	// sorted and non-overlapping (checked in read_bedfile), so within a chromosome this
+	// is a single sweep over SNPs and regions. Chromosomes are done in parallel.
+	//
+	map<string, vector<pair<int, int> > > regions = read_bedfile(bedfile);
+	int nchr = chrcodes.size();
+	vector<vector<int> > bychr(nchr);
+	for (int i = 0; i < d.size(); i++) bychr[d[i].chr].push_back(i);
+	vector<const vector<pair<int, int> >* > chrregions;
+	vector<pair<int, int> > noregions;
+	for (int c = 0; c < nchr; c++){
+		map<string, vector<pair<int, int> > >::const_iterator r = regions.find(chrcodes[c]);
+		if (r == regions.end()) chrregions.push_back(&noregions);
+		else chrregions.push_back(&r->second);
+	}
+	vector<int> nannotated(nchr, 0);
+	snpannot.push_back(vector<char>(d.size(), 0));
+	vector<char>& col = snpannot.back();
+#pragma omp parallel for schedule(dynamic)
+	for (int c = 0; c < nchr; c++){
+		vector<int>& snps = bychr[c];
+		const vector<pair<int, int> >& intervals = *chrregions[c];
+
+		// input is sorted by position except when ordered by SEGNUMBER for fine-mapping
+		bool sorted = true;
+		for (int i = 1; i < snps.size() && sorted; i++) if (d[snps[i]].pos < d[snps[i-1]].pos) sorted = false;
+		if (!sorted){
+			vector<pair<int, int> > bypos;
+			for (int i = 0; i < snps.size(); i++) bypos.push_back(make_pair(d[snps[i]].pos, snps[i]));
+			stable_sort(bypos.begin(), bypos.end());
+			for (int i = 0; i < snps.size(); i++) snps[i] = bypos[i].second;
+		}
+
+		// .bed regions are 0-based half-open, positions are 1-based
+		int j = 0;
+		for (int i = 0; i < snps.size(); i++){
+			int pos = d[snps[i]].pos;
+			while (j < intervals.size() && intervals[j].second < pos) j++;
+			bool inregion = j < intervals.size() && intervals[j].first < pos;
+			col[snps[i]] = inregion;
+			if (inregion) nannotated[c]++;
+		}
+	}
+	int total = 0;
+	for (int c = 0; c < nchr; c++) total += nannotated[c];
+	// binary annotations come before the distance annotations
+	annotnames.insert(annotnames.end()-ndistannot, name);
+	cout << "Annotated "<< total << " variants with "<< name << " from "<< bedfile << "\n";
+}
+
 void SNPs::init_segpriors(){
 	segannot.clear();
 	segpriors.clear();
@@ -156,7 +324,7 @@ void SNPs::init_segpriors(){
 			double segmean = 0.0;
 			int total = 0;
 			for (int i = it->first; i < it->second; i++){
-				segmean += d[i].dens;
+				segmean += snpdens[i];
 				total ++;
 			}
 			segmeans.push_back( segmean / (double) total);
@@ -274,10 +442,10 @@ void SNPs::load_snps_z(string infile, vector<double> prior, vector<string> annot
    		segannotindex = header_index[segannot[0]];
    	}
    	// get indices for the rs, maf, chr, pos, N, Ncase, Ncontrol,
-   	int rsindex, mafindex, chrindex, zindex, posindex, Nindex, Ncaseindex, Ncontrolindex, segnumberindex, condindex, bfindex;
-   	bool override_v = false;
-   	bool override_z = false;
-   	int seindex;
+   	// (the ones needed for output are kept, to read the input again when printing)
+   	int segnumberindex, bfindex;
+   	override_v = false;
+   	override_z = false;
    	if (header_index.find("SEGNUMBER") != header_index.end() && params->finemap == false){
    		cout << "WARNING: detected SEGNUMBER in header, but no -fine flag. Are you sure you're not using the fine-mapping format?\n";
    	}
@@ -345,141 +513,533 @@ void SNPs::load_snps_z(string infile, vector<double> prior, vector<string> annot
    	}
    	else segnumberindex = header_index["SEGNUMBER"];
 
-	if (params->cond && header_index.find(params->testcond_annot) == header_index.end()){
-		cerr << "ERROR: cannot find annotation "<< params->testcond_annot << "\n";
-		exit(1);
+	// annotations for the conditional analysis, "all" is every column that is not one of the
+	// above or in the model (the ones that turn out not to be 0/1 are dropped after reading)
+	vector<int> condindex;
+	bool condall = params->cond && params->testcond_annot.size() == 1 && params->testcond_annot[0] == "all";
+	if (condall){
+		set<string> used(annot.begin(), annot.end());
+		used.insert(qannot.begin(), qannot.end());
+		used.insert(dannot.begin(), dannot.end());
+		used.insert(segannot.begin(), segannot.end());
+		const char* fixed[] = {"SNPID", "CHR", "POS", "F", "Z", "N", "NCASE", "NCONTROL", "SE", "LNBF", "SEGNUMBER"};
+		used.insert(fixed, fixed + sizeof(fixed)/sizeof(fixed[0]));
+		for (int i = 0; i < line.size(); i++){
+			if (used.find(line[i]) != used.end()) continue;
+			condindex.push_back(i);
+			condannotnames.push_back(line[i]);
+		}
+	}
+	else if (params->cond){
+		for (int i = 0; i < params->testcond_annot.size(); i++){
+			if (header_index.find(params->testcond_annot[i]) == header_index.end()){
+				cerr << "ERROR: cannot find annotation "<< params->testcond_annot[i] << "\n";
+				exit(1);
+			}
+			condindex.push_back(header_index[params->testcond_annot[i]]);
+			condannotnames.push_back(params->testcond_annot[i]);
+		}
 	}
-	else if (params->cond) condindex = header_index[params->testcond_annot];
+	condsnps.resize(condindex.size());
+	vector<char> condbinary(condindex.size(), 1);
+
+	TabixReader regionin;
+	bool byregion = open_regions(regionin);
+	if (byregion && regionin.indexed) cout << "Reading "<< regionin.regions.size() << " region(s) from the index of "<< infile << "\n";
+
+	snpannot.resize(annot_index.size());
+	snpdistbin.resize(dannot_index.size());
+	snpqannot.resize(qannot_index.size());
+	// the case-control input has no quantitative values, they are NA
+	vector<int> noqannot(qannot_index.size(), -1);
 	string oldchr = "NA";
-    while(getline(in, st)){
+	int chrcode = -1;
+	long lineno = -1;
+	long lastline = -2;
+	double chunkst = spans.now();
+    while(byregion ? regionin.getline(st) : !getline(in, st).fail()){
+    	lineno++;
+    	if (lineno == RESERVE_AFTER && !byregion){
+    		// reserve for the whole file, from the share of it read so far
+    		long used = in.rdbuf()->compressed_offset();
+    		if (used > 0) reserve_snps((size_t) (1.05 * d.size() * stFileInfo.st_size / used));
+    	}
+    	if (spans.enabled && lineno > 0 && lineno % 100000 == 0){
+    		spans.add("read", chunkst, spans.now(), lineno);
+    		chunkst = spans.now();
+    	}
     	buf.clear();
     	stringstream ss(st);
     	line.clear();
     	while (ss>> buf){
     		line.push_back(buf);
     	}
-    	string rs = line[rsindex];
-
     	double alfreq = atof(line[mafindex].c_str());
     	if (alfreq < 1e-8 and !override_z and !override_v) continue;
     	double z = atof(line[zindex].c_str());
 
     	//quantitative trait
     	if (!params->cc){
-    		int N = atoi(line[Nindex].c_str());
-    		string chr = line[chrindex];
+    		const string& chr = line[chrindex];
     		if (chr != oldchr) {
     			//cout << "Reading "<< chr << "\n"; cout.flush();
     			oldchr = chr;
+    			chrcode = intern_chr(chr);
     		}
     		if (params->dropchr and chr == params->chrtodrop) continue;
     		int pos = atoi(line[posindex].c_str());
-    		vector<bool> an;
-    		vector<int> dists;
-    		for (vector<int>::iterator it = annot_index.begin(); it != annot_index.end(); it++){
-    			if (line[*it] == "1") an.push_back(true);
-    			else if (line[*it] == "0") an.push_back(false);
-    			else{
-    				cerr << "ERROR: only 0 and 1 allowed for annotations, found "<< line[*it] <<"\n";
-    				exit(1);
-    			}
-    		}
-    		for (vector<int>::iterator it = dannot_index.begin(); it != dannot_index.end(); it++){
-    			dists.push_back( atoi(line[*it].c_str()));
-    		}
 
-    		SNP s(rs, chr , pos, N, alfreq, z, prior, an, dists, dmodels);
-    		
-    		for (vector<int>::iterator it = qannot_index.begin(); it != qannot_index.end(); it++){
-				if (strtoupper(line[*it]).compare("NA") == 0) {
-					s.qannotDefined.push_back(false);
-					s.qannot.push_back(0);
-				} else {
-					s.qannotDefined.push_back(true);
-					s.qannot.push_back(atof(line[*it].c_str()));
-				}
-    		}
+    		double v = input_v(line);
+
+    		if (lineno != lastline+1) inputruns.push_back(make_pair((int) d.size(), lineno));
+    		lastline = lineno;
+    		read_annots(line, annot_index, dannot_index, qannot_index);
+    		d.push_back(SNP(chrcode, pos));
+    		Z.push_back(z);
+    		V.push_back(v);
+    		SNP& s = d.back();
     		if (params->finemap){
     			check_string2digit(line[segnumberindex]);
     			int snumber = atoi(line[segnumberindex].c_str());
-    			s.chunknumber = snumber;
+    			snpchunk.push_back(snumber);
     		}
-    		if (segannot.size() > 0) s.dens = atof(line[segannotindex].c_str());
+    		if (segannot.size() > 0) snpdens.push_back(atof(line[segannotindex].c_str()));
 
-    		//if there's SE in the header
-    		if (override_v){
-    			float se = atof(line[seindex].c_str());
-    			s.V = se*se;
-    			s.BF = s.calc_logBF();
-    		}
     		if (override_z){
     			float lnBF = atof(line[bfindex].c_str());
     			s.BF = lnBF;
     		}
-    		if (params->cond){
-    			if (line[condindex] == "1") s.condannot =true;
-    			else if (line[condindex] == "0") s.condannot = false;
-    			else{
-    				cerr << "ERROR: only 0 and 1 allowed for annotations, found "<< line[condindex] <<"\n";
-    				exit(1);
-    			}
-    		}
-    		d.push_back(s);
+    		read_condannots(line, condindex, condbinary, !condall);
     	}
 
     	//case-control study
     	else{
-      		int Ncase = atoi(line[Ncaseindex].c_str());
-      		int Ncontrol = atoi(line[Ncontrolindex].c_str());
-      		string chr = line[chrindex];
+      		const string& chr = line[chrindex];
+      		if (chr != oldchr) {
+      			oldchr = chr;
+      			chrcode = intern_chr(chr);
+      		}
       		if (params->dropchr and chr == params->chrtodrop) continue;
       		int pos = atoi(line[posindex].c_str());
-      		vector<bool> an;
-      		vector<int> dists;
-      		for (vector<int>::iterator it = annot_index.begin(); it != annot_index.end(); it++){
-    			if (line[*it] == "1") an.push_back(true);
-    			else if (line[*it] == "0") an.push_back(false);
-    			else{
-    				cerr << "ERROR: only 0 and 1 allowed for annotations, found "<< line[*it] <<"\n";
-    				exit(1);
-    			}
-
-        	}
-      		for (vector<int>::iterator it = dannot_index.begin(); it != dannot_index.end(); it++){
-      			dists.push_back( atoi(line[*it].c_str()));
-        	}
-
-      		SNP s(rs, chr , pos, Ncase, Ncontrol, alfreq, z, prior, an, dists, dmodels);
+
+      		double v = input_v(line);
+
+      		if (lineno != lastline+1) inputruns.push_back(make_pair((int) d.size(), lineno));
+      		lastline = lineno;
+      		read_annots(line, annot_index, dannot_index, noqannot);
+      		d.push_back(SNP(chrcode, pos));
+    		Z.push_back(z);
+    		V.push_back(v);
+      		SNP& s = d.back();
     		if (params->finemap){
     			check_string2digit(line[segnumberindex]);
     			int snumber = atoi(line[segnumberindex].c_str());
-    			s.chunknumber = snumber;
+    			snpchunk.push_back(snumber);
     		}
-      		if (segannot.size() > 0) s.dens = atof(line[segannotindex].c_str());
-
-      		//if there's SE in the header
-       		if (override_v){
-       			float se = atof(line[seindex].c_str());
-       			s.V = se*se;
-       			s.BF = s.calc_logBF();
-       		}
+      		if (segannot.size() > 0) snpdens.push_back(atof(line[segannotindex].c_str()));
+
       		if (override_z){
         			float lnBF = atof(line[bfindex].c_str());
         			s.BF = lnBF;
       		}
-      		if (params->cond){
-      			if (line[condindex] == "1") s.condannot =true;
-      			else if (line[condindex] == "0") s.condannot = false;
-      			else{
-      				cerr << "ERROR: only 0 and 1 allowed for annotations, found "<< line[condindex] <<"\n";
-      				exit(1);
-      			}
-      		}
-      		d.push_back(s);
-
+      		read_condannots(line, condindex, condbinary, !condall);
     	}
     }
+    spans.add("read", chunkst, spans.now(), lineno+1);
     cout << "Read "<< d.size() << " variants\n";
+    if (condall){
+    	// keep the 0/1 columns
+    	int k = 0;
+    	for (int j = 0; j < condsnps.size(); j++){
+    		if (!condbinary[j]) continue;
+    		condannotnames[k] = condannotnames[j];
+    		condsnps[k].swap(condsnps[j]);
+    		k++;
+    	}
+    	condannotnames.resize(k);
+    	condsnps.resize(k);
+    	if (k == 0){
+    		cerr << "ERROR: -cond all found no 0/1 annotations outside the model\n";
+    		exit(1);
+    	}
+    	cout << "Conditional analysis of "<< k << " annotation(s)\n";
+    }
+    if (!override_z) set_BFs(prior);
+    // only needed again for output and -vsweep, which read them back from the input
+    free_zv();
+}
+
+void SNPs::read_condannots(const vector<string>& line, const vector<int>& condindex, vector<char>& binary, bool strict){
+	// SNPs carrying each -cond annotation (the SNP just read is the last one)
+	int i = d.size()-1;
+	for (int j = 0; j < condindex.size(); j++){
+		if (!binary[j]) continue;
+		const string& v = line[condindex[j]];
+		if (v == "1") condsnps[j].push_back(i);
+		else if (v != "0"){
+			if (strict){
+				cerr << "ERROR: only 0 and 1 allowed for annotations, found "<< v <<"\n";
+				exit(1);
+			}
+			binary[j] = 0;
+			vector<int>().swap(condsnps[j]);
+		}
+	}
+}
+
+void SNPs::read_annots(const vector<string>& line, const vector<int>& annot_index, const vector<int>& dannot_index, const vector<int>& qannot_index){
+	// annotations of the SNP about to be added (a quantitative index of -1 is NA)
+	for (int j = 0; j < annot_index.size(); j++){
+		const string& a = line[annot_index[j]];
+		if (a == "1") snpannot[j].push_back(1);
+		else if (a == "0") snpannot[j].push_back(0);
+		else{
+			cerr << "ERROR: only 0 and 1 allowed for annotations, found "<< a <<"\n";
+			exit(1);
+		}
+	}
+	for (int j = 0; j < dannot_index.size(); j++) snpdistbin[j].push_back(find_distbin(j, atoi(line[dannot_index[j]].c_str())));
+	for (int j = 0; j < qannot_index.size(); j++){
+		if (qannot_index[j] < 0 || strtoupper(line[qannot_index[j]]).compare("NA") == 0) snpqannot[j].push_back(numeric_limits<double>::quiet_NaN());
+		else snpqannot[j].push_back(atof(line[qannot_index[j]].c_str()));
+	}
+}
+
+short SNPs::find_distbin(int model, int dist){
+	// bins are sorted and don't overlap, so the only candidate is the last bin starting at or before the distance
+	const vector<DistBin>& bins = dbins[model];
+	int lo = 0;
+	int hi = bins.size();
+	while (lo < hi){
+		int mid = (lo+hi)/2;
+		if (bins[mid].st <= dist) lo = mid+1;
+		else hi = mid;
+	}
+	if (lo > 0 && dist < bins[lo-1].sp) return bins[lo-1].index;
+	return -1;
+}
+
+void SNPs::reserve_snps(size_t n){
+	d.reserve(n);
+	Z.reserve(n);
+	V.reserve(n);
+	for (int j = 0; j < snpannot.size(); j++) snpannot[j].reserve(n);
+	for (int j = 0; j < snpdistbin.size(); j++) snpdistbin[j].reserve(n);
+	for (int j = 0; j < snpqannot.size(); j++) snpqannot[j].reserve(n);
+	if (params->finemap) snpchunk.reserve(n);
+	if (params->segannot.size() > 0) snpdens.reserve(n);
+}
+
+bool SNPs::get_annot(int i, int j){
+	if (j < snpannot.size()) return snpannot[j][i];
+	j -= snpannot.size();
+	for (int m = 0; m < snpdistbin.size(); m++){
+		if (snpdistbin[m][i] == j) return true;
+	}
+	return false;
+}
+
+double SNPs::get_x(int i, const vector<double>& lambda){
+	if (lambda.size() != nannot){
+		cerr << "ERROR: SNP at position "<< d[i].pos << ". Lambda has "<< lambda.size()<< " entries. nannot is " << nannot << "\n";
+		exit(1);
+	}
+	double toreturn = 0;
+	int nbinary = snpannot.size();
+	for (int j = 0; j < nbinary; j++) {
+		if (snpannot[j][i]) toreturn += lambda[j];
+	}
+	// one lookup per distance model
+	for (int j = 0; j < snpdistbin.size(); j++) {
+		if (snpdistbin[j][i] >= 0) toreturn += lambda[nbinary+snpdistbin[j][i]];
+	}
+	return toreturn;
+}
+
+double SNPs::get_x_cond(int i, const vector<double>& lambda, const vector<QuantParams>& qparams){
+	double toreturn = get_x(i, lambda);
+	for (int j = 0; j < qparams.size(); j++) {
+		double q = snpqannot[j][i];
+		if (!isnan(q)) toreturn += qparams[j].lambda / (1 + exp(-qparams[j].b1 * (q - qparams[j].b0)));
+	}
+	return toreturn;
+}
+
+double SNPs::input_v(const vector<string>& line){
+	// variance of the effect size of the SNP on an input line
+	if (override_v){
+		//if there's SE in the header
+		float se = atof(line[seindex].c_str());
+		return se*se;
+	}
+	double alfreq = atof(line[mafindex].c_str());
+	if (params->cc) return SNP::approx_v_cc(alfreq, atoi(line[Ncaseindex].c_str()), atoi(line[Ncontrolindex].c_str()));
+	return SNP::approx_v(alfreq, atoi(line[Nindex].c_str()));
+}
+
+void SNPs::read_zv(){
+	// Z and V of all SNPs, from the input
+	Span span(spans, "read Z and V");
+	SNPOutputReader reader(this);
+	string id;
+	Z.resize(d.size());
+	V.resize(d.size());
+	for (int i = 0; i < d.size(); i++) reader.get(i, id, Z[i], V[i]);
+}
+
+void SNPs::free_zv(){
+	vector<double>().swap(Z);
+	vector<double>().swap(V);
+}
+
+void SNPs::set_BFs(const vector<double>& W){
+	//
+	// log BF of each SNP averaged over the prior variances W. This is a separate pass over
+	// the Z and V arrays rather than part of reading, so it can be done again with another
+	// grid. SNPs are done in blocks, in parallel, with the loop over a block innermost.
+	//
+	if (override_z){
+		cout << "WARNING: Bayes factors were read from LNBF, not recomputing them\n";
+		return;
+	}
+	if (Z.size() != d.size()) read_zv();
+	const int blocksize = 256;
+	int n = d.size();
+	int nblock = (n + blocksize - 1) / blocksize;
+	double lognw = log(W.size());
+	const double* z = &Z[0];
+	const double* v = &V[0];
+	#pragma omp parallel
+	{
+		Span span(spans, "bayes factors");
+		#pragma omp for schedule(static) nowait
+		for (int b = 0; b < nblock; b++){
+			int st = b*blocksize;
+			int sp = min(n, st+blocksize);
+			double acc[blocksize];
+			for (int k = 0; k < W.size(); k++){
+				double w = W[k];
+				for (int i = st; i < sp; i++){
+					double r = w / (v[i]+w);
+					double lbf = -(-log(sqrt(1-r)) - z[i]*z[i]*r/2);
+					if (k == 0) acc[i-st] = lbf;
+					else{
+						// sumlog without a branch
+						double hi = max(acc[i-st], lbf);
+						double lo = min(acc[i-st], lbf);
+						acc[i-st] = hi + log(1 + exp(lo-hi));
+					}
+				}
+			}
+			for (int i = st; i < sp; i++) d[i].BF = acc[i-st] - lognw;
+		}
+	}
+	if (!segments.empty()) make_patterns();
+}
+
+void SNPs::make_patterns(){
+	//
+	// per-segment table of distinct annotation patterns (binary annotations and distance bins).
+	// Only used if it is at most half the size of the data.
+	//
+	// With quantitative annotations SNPs differ in their priors, and the table is only made with
+	// -prune eps slope. Then SNPs with a BF far below the segment maximum are grouped by pattern
+	// and by cells of width w of each quantitative annotation, and each group is evaluated at the
+	// centre of its cells. While lambda*b1/4 (the largest slope of the logistic) is at most slope
+	// for every annotation, x of a SNP in a group is within eps/(2*nq) of the group's for each
+	// annotation where the logistic is smooth; the QUANT_THRESH cut-off adds up to 0.01*|lambda|
+	// for cells across it. within_prune_bound checks that the sum is at most eps/2, so the prior
+	// of each SNP in a group is within a factor exp(eps/2) of the group's, both the normalizer
+	// and sum(prior*BF) of the segment are within that factor, and its ln(lk) is within eps.
+	//
+	usepatterns = false;
+	pruned = false;
+	segpatst.clear();
+	patsnp.clear();
+	patlogn.clear();
+	patbf.clear();
+	patq.clear();
+	seginvariant.assign(segments.size(), 0);
+	seginvlsum.assign(segments.size(), 0);
+	int nq = quantannotnames.size();
+	if (nq > 0 && params->prune_eps <= 0) return;
+	pruned = nq > 0;
+	double w = pruned ? params->prune_eps / (nq * params->prune_slope) : 0;
+	int nbinary = nannot - ndistannot;
+	map<vector<long long>, int> index;
+	vector<long long> key;
+	vector<double> lbf;
+	for (int s = 0; s < segments.size(); s++){
+		segpatst.push_back(patsnp.size());
+		index.clear();
+		double maxbf = d[segments[s].first].BF;
+		for (int i = segments[s].first; i < segments[s].second; i++) maxbf = max(maxbf, d[i].BF);
+		for (int i = segments[s].first; i < segments[s].second; i++){
+			key.clear();
+			bool keep = pruned && !(d[i].BF < maxbf - PRUNE_KEEP_LBF);
+			if (keep) key.push_back(i);
+			else key.push_back(-1);
+			for (int j = 0; j < nbinary; j++) if (snpannot[j][i]) key.push_back(j);
+			for (int j = 0; j < snpdistbin.size(); j++) key.push_back(snpdistbin[j][i]);
+			for (int j = 0; j < nq && !keep; j++){
+				if (!isnan(snpqannot[j][i])) key.push_back((long long) floor(snpqannot[j][i] / w));
+				else key.push_back(LLONG_MIN);
+			}
+			map<vector<long long>, int>::iterator it = index.find(key);
+			if (it == index.end()){
+				index[key] = patsnp.size();
+				patsnp.push_back(i);
+				patlogn.push_back(0);
+				lbf.push_back(d[i].BF);
+				for (int j = 0; j < nq; j++){
+					if (isnan(snpqannot[j][i])) patq.push_back(numeric_limits<double>::quiet_NaN());
+					else if (keep) patq.push_back(snpqannot[j][i]);
+					else patq.push_back((key[key.size()-nq+j] + 0.5) * w);
+				}
+				continue;
+			}
+			int p = it->second;
+			patlogn[p] = sumlog(patlogn[p], 0);
+			lbf[p] = sumlog(lbf[p], d[i].BF);
+		}
+		// (not with -cond, where set_priors_cond adds 1 to the normalizer)
+		int p = segpatst[s];
+		if (index.size() == 1 && !params->cond && nq == 0 && isfinite(lbf[p] - patlogn[p])){
+			seginvariant[s] = 1;
+			seginvlsum[s] = lbf[p] - patlogn[p];
+		}
+	}
+	int ninvariant = 0;
+	for (int s = 0; s < segments.size(); s++) ninvariant += seginvariant[s];
+	if (ninvariant > 0) cout << ninvariant << " of "<< segments.size() << " segments have one annotation pattern, their likelihood does not depend on the SNP-level parameters\n";
+	segpatst.push_back(patsnp.size());
+	if (2*patsnp.size() > d.size()) {
+		if (pruned) cout << "WARNING: -prune leaves "<< patsnp.size() << " of "<< d.size() << " SNPs, not using it\n";
+		segpatst.clear();
+		patsnp.clear();
+		patlogn.clear();
+		patq.clear();
+		pruned = false;
+		return;
+	}
+	for (int p = 0; p < patsnp.size(); p++) patbf.push_back(lbf[p] - patlogn[p]);
+	usepatterns = true;
+	if (pruned) cout << "Likelihood evaluations while optimizing over "<< patsnp.size() << " SNPs and groups of SNPs ("<< d.size() << " SNPs), ln(lk) of each segment within "<< params->prune_eps << " while lambda*b1/4 <= "<< params->prune_slope << "\n";
+	else cout << "Likelihood evaluations over "<< patsnp.size() << " annotation patterns ("<< d.size() << " SNPs)\n";
+}
+
+bool SNPs::within_prune_bound(const ModelPoint& pt){
+	// largest difference in x between a grouped SNP and its group (see make_patterns)
+	int nq = pt.quantparams.size();
+	double w = params->prune_eps / (nq * params->prune_slope);
+	double jump = 1 / (1 + exp(QUANT_THRESH));
+	double dev = 0;
+	for (int j = 0; j < nq; j++){
+		double slope = fabs(pt.quantparams[j].lambda * pt.quantparams[j].b1) / 4;
+		if (slope > params->prune_slope) return false;
+		dev += slope * w / 2 + jump * fabs(pt.quantparams[j].lambda);
+	}
+	return dev <= params->prune_eps / 2;
+}
+
+double SNPs::invariant_llk(int which, double segprior){
+	// as llk(int), for a segment in seginvariant
+	if (params->finemap) return seginvlsum[which];
+	return sumlog(log(segprior) + seginvlsum[which], log(1-segprior));
+}
+
+pair<int, int> SNPs::unit_range(int which, bool units){
+	if (units) return make_pair(segpatst[which], segpatst[which+1]);
+	return segments[which];
+}
+
+double SNPs::unit_x(int u, const ModelPoint& pt, const vector<vector<double> >& tables, bool units){
+	// x of a unit, with ln(count) added so the priors of its SNPs sum to exp(x)
+	if (!units) return point_x(u, pt, tables);
+	if (!pruned) return point_x(patsnp[u], pt, tables) + patlogn[u];
+	// as point_x, at the quantitative annotation values of the unit
+	double x = get_x(patsnp[u], pt.lambdas);
+	for (int j = 0; j < pt.quantparams.size(); j++){
+		double q = patq[(size_t) u*pt.quantparams.size() + j];
+		if (!isfinite(q)) continue;
+		double exponent = -pt.quantparams[j].b1 * (q - pt.quantparams[j].b0);
+		if (exponent < -QUANT_THRESH) x += pt.quantparams[j].lambda;
+		else if (exponent < QUANT_THRESH) x += pt.quantparams[j].lambda / (1 + exp(exponent));
+	}
+	return x + patlogn[u];
+}
+
+double SNPs::unit_bf(int u, bool units){
+	if (units) return patbf[u];
+	return d[u].BF;
+}
+
+int SNPs::unit_snp(int u, bool units){
+	if (units) return patsnp[u];
+	return u;
+}
+
+int SNPs::intern_chr(const string& chr){
+	map<string, int>::iterator it = chrcodeindex.find(chr);
+	if (it != chrcodeindex.end()) return it->second;
+	int code = chrcodes.size();
+	chrcodes.push_back(chr);
+	chrcodeindex[chr] = code;
+	return code;
+}
+
+bool SNPs::open_regions(TabixReader& regionin){
+	// with -region/-chroms (or -drop), use the index to only decompress the parts of the file we need
+	if (params->regions.size() > 0) return regionin.open(params->infile, params->regions, chrindex, posindex);
+	if (params->dropchr) return regionin.open_except(params->infile, params->chrtodrop, chrindex, posindex);
+	return false;
+}
+
+SNPOutputReader::SNPOutputReader(SNPs* s){
+	snps = s;
+	in = NULL;
+	byregion = false;
+	nread = -1;
+	run = 0;
+}
+
+SNPOutputReader::~SNPOutputReader(){
+	if (in != NULL) delete in;
+}
+
+void SNPOutputReader::open(){
+	// start again from the top of the input, skipping the header
+	if (in != NULL) delete in;
+	in = new igzstream(snps->params->infile.c_str());
+	getline(*in, st);
+	regionin.close();
+	byregion = snps->open_regions(regionin);
+	nread = 0;
+}
+
+void SNPOutputReader::get(int snp, string& id, double& z, double& v){
+	// find the run of consecutive input lines holding this SNP
+	vector<pair<int, long> >& runs = snps->inputruns;
+	if (run >= runs.size() || runs[run].first > snp) run = 0;
+	while (run+1 < runs.size() && runs[run+1].first <= snp) run++;
+	long target = runs[run].second + (snp - runs[run].first);
+
+	if (nread < 0 || target < nread-1) open();
+	while (nread <= target){
+		bool ok = byregion ? regionin.getline(st) : !getline(*in, st).fail();
+		if (!ok){
+			cerr << "ERROR: "<< snps->params->infile << " changed since it was read\n";
+			exit(1);
+		}
+		nread++;
+	}
+	line.clear();
+	stringstream ss(st);
+	string buf;
+	while (ss >> buf) line.push_back(buf);
+	id = line[snps->rsindex];
+	z = atof(line[snps->zindex].c_str());
+	v = snps->input_v(line);
 }
 
 void SNPs::check_string2digit(string s){
@@ -508,55 +1068,94 @@ vector<pair< pair<int, int>, pair<double, double> > > SNPs::get_cis(){
 	for (vector<QuantParams>::iterator it = quantparams.begin(); it != quantparams.end(); it++) startquantlambdas.push_back(it->lambda);
 	for (vector<double>::iterator it = seglambdas.begin(); it != seglambdas.end(); it++) startseglambdas.push_back(*it);
 	if (!params->finemap) {
-		toreturn.push_back(get_cis_segpi());
+		if (next_ci(toreturn)){
+			toreturn.push_back(get_cis_segpi());
+			done_ci(toreturn);
+		}
 		segpi = startsegpi;
 		set_priors();
 		for (int i = 0; i < seglambdas.size(); i++){
+			if (!next_ci(toreturn)) continue;
 			toreturn.push_back(get_cis_param(&seglambdas[i]));
+			done_ci(toreturn);
 			seglambdas[i] = startseglambdas[i];
 			set_priors();
 		}
 	}
 	segpi = startsegpi;
 	for (int i = 0; i < lambdas.size(); i++){
+		if (!next_ci(toreturn)) continue;
 		toreturn.push_back(get_cis_param(&lambdas[i]));
+		done_ci(toreturn);
 		lambdas[i] = startlambdas[i];
 		set_priors();
 	}
 	for (int i = 0; i < quantparams.size(); i++){
+		if (!next_ci(toreturn)) continue;
 		toreturn.push_back(get_cis_param(&quantparams[i].lambda));
+		done_ci(toreturn);
 		quantparams[i].lambda = startquantlambdas[i];
 		set_priors();
 	}
 	return toreturn;
 }
 
-pair< pair<int, int>, pair<double, double> > SNPs::get_cis_condlambda(){
-	double startlk = llk();
-	double thold = startlk - 2;
-	cout <<  startlk << " "<< thold << "\n";
+bool SNPs::next_ci(vector<pair<pair<int, int>, pair<double, double> > >& cis){
+	// false if the next CI is taken from the checkpoint, or not done (3) after -timelimit
+	ostringstream ss;
+	ss << "ci" << cis.size();
+	optim_phase = ss.str();
+	if (ckpt.has(optim_phase)){
+		const vector<double>& in = ckpt.get(optim_phase);
+		cis.push_back(make_pair(make_pair((int) in[0], (int) in[1]), make_pair(in[2], in[3])));
+		return false;
+	}
+	if (!timed_out && ckpt.out_of_time()) stop_for_time();
+	if (timed_out){
+		cis.push_back(make_pair(make_pair(3, 3), make_pair(0.0, 0.0)));
+		return false;
+	}
+	return true;
+}
+
+void SNPs::done_ci(const vector<pair<pair<int, int>, pair<double, double> > >& cis){
+	const pair<pair<int, int>, pair<double, double> >& ci = cis.back();
+	vector<double> out;
+	out.push_back(ci.first.first);
+	out.push_back(ci.first.second);
+	out.push_back(ci.second.first);
+	out.push_back(ci.second.second);
+	ckpt.put(optim_phase, out);
+}
+
+pair< pair<int, int>, pair<double, double> > SNPs::get_cis_cond(const CondTerms& t, double est){
+	Span span(spans, "ci search cond");
+	double thold = cond_llk(t, est) - 2;
 	double min = -20.0;
 	double max = 20.0;
-	double test = condlambda;
-	if (test > max) max = test+20.0;
-	if (test < min) min = test-20.0;
-	if (max < 0) max = 20.0;
-	if (min > 0) min = -20.0;
-	double start = (test+max)/2;
+	if (est > max) max = est+20.0;
+	if (est < min) min = est-20.0;
 	double tau = 0.001;
-	int convhi = golden_section_condlambda_ci(test, start, max, tau, thold);
-	double hi = condlambda;
-	cout << hi << " "<< llk() << " hi\n";
-	start = (test+min)/2;
-	int convlo = golden_section_condlambda_ci(min, start, test, tau, thold);
-	double lo = condlambda;
-	cout << lo << " "<< llk() << " lo\n";
+	int convhi, convlo;
+	double hi, lo;
+	// as get_cis_segpi, the ends of the range if ln(lk) there is still above the threshold
+	if (cond_llk(t, max) < thold) convhi = golden_section_cond_ci(t, est, (est+max)/2, max, tau, thold, &hi);
+	else{
+		hi = max;
+		convhi = 2;
+	}
+	if (cond_llk(t, min) < thold) convlo = golden_section_cond_ci(t, min, (est+min)/2, est, tau, thold, &lo);
+	else{
+		lo = min;
+		convlo = 2;
+	}
 	pair<int, int> conv = make_pair(convlo, convhi);
 	pair<double, double> ci = make_pair(lo, hi);
 	return make_pair(conv, ci);
 }
 
 pair< pair<int, int>, pair<double, double> > SNPs::get_cis_segpi(){
+	Span span(spans, "ci search pi");
 	double startsegpi = segpi;
 	double startlk = llk();
 	double thold = startlk - 2;
@@ -570,10 +1169,14 @@ pair< pair<int, int>, pair<double, double> > SNPs::get_cis_segpi(){
 	int convhi, convlo;
 	double hi, lo;
 	double tau = 0.001;
-	// see if value at max is less than thold
-	segpi = 1.0  / ( 1.0 + exp(-max));
-	set_priors();
-	double maxllk = llk();
+	// see if values at max and min are less than thold
+	vector<double> vals;
+	vals.push_back(1.0  / ( 1.0 + exp(-max)));
+	vals.push_back(1.0  / ( 1.0 + exp(-min)));
+	const vector<double>& lks = llk_batch(&segpi, vals);
+	double maxllk = lks[0];
+	double minllk = lks[1];
+	double hillk, lollk;
 
 	//if yes, do optimization
 	if (maxllk < thold){
@@ -582,38 +1185,39 @@ pair< pair<int, int>, pair<double, double> > SNPs::get_cis_segpi(){
 
 		convhi = golden_section_segpi_ci(test, start, max, tau, thold,  &nit);
 		hi = segpi;
+		hillk = llk();
 	}
 	else{
 		hi =1.0  / ( 1.0 + exp(-max));
 		convhi = 2;
+		hillk = maxllk;
 	}
-	cout << hi << " "<< llk() << " hi\n";
+	if (params->loglevel > 1) cout << hi << " "<< hillk << " hi\n";
 
 	// same for min
-	segpi = 1.0  / ( 1.0 + exp(-min));
-	set_priors();
-	double minllk = llk();
-
 	if (minllk < thold){
 		double start = (test+min)/2;
 		int nit = 0;
 		convlo = golden_section_segpi_ci(min, start, test, tau, thold, &nit);
 		lo = segpi;
+		lollk = llk();
 	}
 	else{
 		lo = 1.0  / ( 1.0 + exp(-min));
 		convlo = 2;
+		lollk = minllk;
 	}
-	cout << lo << " "<< llk() << " lo\n";
+	if (params->loglevel > 1) cout << lo << " "<< lollk << " lo\n";
 	pair<int, int> conv = make_pair(convlo, convhi);
 	pair<double, double> ci = make_pair(lo, hi);
 	return make_pair(conv, ci);
 }
 
 pair< pair<int, int>, pair<double, double> > SNPs::get_cis_param(double* pParam) {
+	Span span(spans, "ci search");
 	double startlk = llk();
 	double thold = startlk - 2;
-	cout <<  startlk << " "<< thold << "\n";
+	if (params->loglevel > 1) cout <<  startlk << " "<< thold << "\n";
 	double min = -20.0;
 	double max = 20.0;
 	double test = *pParam;
@@ -627,32 +1231,36 @@ pair< pair<int, int>, pair<double, double> > SNPs::get_cis_param(double* pParam)
 	int convhi, convlo;
 
 
-	//test if maximum is less than thold
-	*pParam = max;
-	set_priors();
-	double maxllk = llk();
+	//test if maximum and minimum are less than thold
+	vector<double> vals;
+	vals.push_back(max);
+	vals.push_back(min);
+	const vector<double>& lks = llk_batch(pParam, vals);
+	double maxllk = lks[0];
+	double minllk = lks[1];
+	double hillk, lollk;
 	if (maxllk < thold) {
 		convhi = golden_section_ci(test, start, max, tau, thold, pParam);
 		hi = *pParam;
+		hillk = llk();
 	} else {
 		convhi = 2;
 		hi = max;
+		hillk = maxllk;
 	}
-	cout << hi << " "<< llk() << " hi\n";
+	if (params->loglevel > 1) cout << hi << " "<< hillk << " hi\n";
 
-	*pParam = min;
-	set_priors();
-	double minllk = llk();
-	
 	start = (test+min)/2;
 	if (minllk < thold) {
 		convlo = golden_section_ci(min, start, test, tau, thold, pParam);
 		lo = *pParam;
+		lollk = llk();
 	} else {
 		convlo = 2;
 		lo = min;
+		lollk = minllk;
 	}
-	cout << lo << " "<< llk() << " lo\n";
+	if (params->loglevel > 1) cout << lo << " "<< lollk << " lo\n";
 	pair<int, int> conv = make_pair(convlo, convhi);
 	pair<double, double> ci = make_pair(lo, hi);
 	return make_pair(conv, ci);
@@ -763,14 +1371,19 @@ void SNPs::print(){
 	for (int i=0; i < nannot; i++) cout << " "<< annotnames[i];
 	for (int i=0; i < quantannotnames.size(); i++) cout << " "<< quantannotnames[i];
 	cout << "\n";
-	for (vector<SNP>::iterator it = d.begin(); it != d.end(); it++){
-		cout << it->id << " "<< it->chr << " "<< it->pos << " "<< it->BF <<  " "<< it->Z;
-		for (int i = 0; i < nannot; i++) cout << " "<< it->annot[i];
+	SNPOutputReader reader(this);
+	string id;
+	double z, v;
+	for (int j = 0; j < d.size(); j++){
+		vector<SNP>::iterator it = d.begin()+j;
+		reader.get(j, id, z, v);
+		cout << id << " "<< chrname(j) << " "<< it->pos << " "<< it->BF <<  " "<< z;
+		for (int i = 0; i < nannot; i++) cout << " "<< get_annot(j, i);
 		for (int i = 0; i < quantannotnames.size(); i++) {
-			if (it->qannotDefined[i]) {
+			if (!isnan(snpqannot[i][j])) {
 				cout << " NA";
 			} else {
-				cout << " " << it->qannot[i];
+				cout << " " << snpqannot[i][j];
 			}
 		}
 		cout << "\n";
@@ -778,12 +1391,15 @@ void SNPs::print(){
 }
 
 void SNPs::print(string outfile, string outfile2){
+	// declared first, so the span includes closing (and flushing) the files
+	Span span(spans, "write output");
 	ogzstream out(outfile.c_str());
 	ogzstream out2(outfile2.c_str());
 	print_header(out, out2);
 
+	SNPOutputReader reader(this);
 	for (int i = 0; i < segments.size(); i++){
-		print(i, out, out2);
+		print(i, out, out2, reader);
 	}
 }
 
@@ -797,12 +1413,12 @@ void SNPs::print_header(ogzstream& outSNP, ogzstream& outSeg){
 	outSeg << "\n";
 }
 
-void SNPs::print(int segnum, ogzstream& outSNP, ogzstream& outSeg){
+void SNPs::print(int segnum, ogzstream& outSNP, ogzstream& outSeg, SNPOutputReader& reader){
 	pair<int, int> seg = segments[segnum];
 	int stindex = seg.first;
 	int spindex = seg.second;
 
-	outSeg << segnum << " " << spindex-stindex << " "<< d[stindex].chr << " "<< d[stindex].pos << " "<< d[spindex-1].pos << " ";
+	outSeg << segnum << " " << spindex-stindex << " "<< chrname(stindex) << " "<< d[stindex].pos << " "<< d[spindex-1].pos << " ";
 	double segp = segpriors[segnum];
 	double seglpio = log(segp)- log(1-segp);
 	double seglPO;
@@ -810,11 +1426,16 @@ void SNPs::print(int segnum, ogzstream& outSNP, ogzstream& outSeg){
 	double segPPA;
 	double sum = 0;
 	double maxZ = 0;
+	// identifiers, Z and V of the segment's SNPs, read back from the input
+	int n = spindex-stindex;
+	vector<string> ids(n);
+	vector<double> zs(n), vs(n);
+	for (int i = stindex; i < spindex; i++) reader.get(i, ids[i-stindex], zs[i-stindex], vs[i-stindex]);
 	for (int i = stindex; i < spindex; i++){
 		double logpi = snppri[i];
 		double logbf = d[i].BF;
-		double Z = fabs(d[i].Z);
-		if (Z> maxZ) maxZ = Z;
+		double absZ = fabs(zs[i-stindex]);
+		if (absZ> maxZ) maxZ = absZ;
 		logsegbf= sumlog(logsegbf, logpi+logbf);
 	}
 	seglPO = logsegbf+ seglpio;
@@ -836,13 +1457,13 @@ void SNPs::print(int segnum, ogzstream& outSNP, ogzstream& outSeg){
 		double lPO = d[i].BF + lpio;
 		double tPPA = cPPA*segPPA;
 		double PPA = exp(lPO)/  ( 1+ exp(lPO));
-		outSNP << d[i].id << " "<< d[i].chr << " "<< d[i].pos << " "<< d[i].BF <<  " "<< d[i].Z <<  " " << d[i].V << " "<< snppri[i] << " "<< lPO  << " "<< PPA << " " << tPPA << " "<< segnum;
-		for (int j = 0; j < annotnames.size(); j++) outSNP << " "<< d[i].annot[j];
+		outSNP << ids[i-stindex] << " "<< chrname(i) << " "<< d[i].pos << " "<< d[i].BF <<  " "<< zs[i-stindex] <<  " " << vs[i-stindex] << " "<< snppri[i] << " "<< lPO  << " "<< PPA << " " << tPPA << " "<< segnum;
+		for (int j = 0; j < annotnames.size(); j++) outSNP << " "<< get_annot(i, j);
 		for (int j = 0; j < quantannotnames.size(); j++) {
-			if (d[i].qannotDefined[j]) {
+			if (!isnan(snpqannot[j][i])) {
 				outSNP << " NA";
 			} else {
-				outSNP << " " << d[i].qannot[j];
+				outSNP << " " << snpqannot[j][i];
 			}
 		}
 		outSNP << "\n";
@@ -863,11 +1484,14 @@ vector<double> SNPs::cross10(bool penalize, ostringstream& ostr, string outfileS
 		this->print_header(outSNP, outSeg);
 	}
 	
+	SNPOutputReader reader(this);
 	vector< set<int> > split10 = make_cross10();
 	vector<double> Lstar;
 	int fold = 1;
 	for (vector<set<int> >::iterator it = split10.begin(); it != split10.end(); it++, fold++){
-		GSL_xv_optim(*it, penalize);
+		Span span(spans, "xv fold", fold);
+		GSL_xv_optim(*it, penalize, fold);
+		if (timed_out) break;
 		double tmpllk = 0;
 		for (set<int>::iterator it2 = it->begin(); it2 != it->end(); it2++)
 			tmpllk += llk(*it2);
@@ -881,8 +1505,9 @@ vector<double> SNPs::cross10(bool penalize, ostringstream& ostr, string outfileS
 		for (int i = 0; i < quantparams.size(); i++) ostr << quantannotnames[i] << " " << quantparams[i].lambda << " " << quantparams[i].b0 << " " << quantparams[i].b1 << endl;
 		
 		if (!outfileSNPs.empty() && !outfileSegs.empty()) {
+			Span span(spans, "write output", fold);
 			for (set<int>::iterator it2 = it->begin(); it2 != it->end(); it2++)
-				this->print(*it2, outSNP, outSeg);
+				this->print(*it2, outSNP, outSeg, reader);
 		}
 	}
 	return Lstar;
@@ -1030,13 +1655,12 @@ void SNPs::make_segments(string bedfile){
 }
 void SNPs::make_segments(int size){
 	segments.clear();
-	int counter = 0;
 	for (vector<pair<int, int> >::iterator it = chrsegments.begin(); it != chrsegments.end(); it++){
 		int starti = it->first;
 		int endi = it->second;
 		int length = endi-starti;
 		if (length < size){
-			cerr << "ERROR: chromosome "<< d[starti].chr << " has "<< length << " SNPs, requesting blocks of size "<< size << "\n";
+			cerr << "ERROR: chromosome "<< chrname(starti) << " has "<< length << " SNPs, requesting blocks of size "<< size << "\n";
 			exit(1);
 		}
 		int bestmod = length % size;
@@ -1055,8 +1679,6 @@ void SNPs::make_segments(int size){
 			int send = starti+i*bestsize+bestsize;
 			if (i > (nseg-2))	send = endi;
 			segments.push_back(make_pair(sstart, send));
-			for (int i = sstart ; i < send ; i++) d[i].chunknumber = counter;
-			counter++;
 		}
 	}
 }
@@ -1065,9 +1687,9 @@ void SNPs::make_segments_finemap(){
 	//cout << "here\n"; cout.flush();
 	segments.clear();
 	int sstart = 0;
-	int wseg = d[0].chunknumber;
+	int wseg = snpchunk[0];
 	for (int i = 1; i < d.size(); i++){
-		int testseg = d[i].chunknumber;
+		int testseg = snpchunk[i];
 		if (testseg < wseg){
 			cerr<< "ERROR: segment number "<< testseg << " occurs after "<< wseg << ". For fine-mapping, order the input file by SEGNUMBER.\n";
 			exit(1);
@@ -1087,13 +1709,13 @@ void SNPs::make_chrsegments(){
 	int i = 0;
 	int start = i;
 	int startpos = d[i].pos;
-	string startchr = d[i].chr;
+	int startchr = d[i].chr;
 	while (i < d.size()){
 		int tmppos = d[i].pos;
-		string tmpchr = d[i].chr;
+		int tmpchr = d[i].chr;
 		if (tmpchr != startchr){
 			int end = i;
-			chrnames.push_back(startchr);
+			chrnames.push_back(chrcodes[startchr]);
 			chrsegments.push_back(make_pair(start, end));
 			start = i;
 			startpos = d[i].pos;
@@ -1102,7 +1724,7 @@ void SNPs::make_chrsegments(){
 		i++;
 	}
 	int end = i;
-	chrnames.push_back(startchr);
+	chrnames.push_back(chrcodes[startchr]);
 	chrsegments.push_back(make_pair(start, end));
 }
 
@@ -1119,16 +1741,196 @@ void SNPs::print_chrsegments(){
 }
 
 void SNPs::set_priors(){
+	counters.setpriors++;
 	set_segpriors(); // a bit of computation for nothing if there's no segment annotations, spot for speed improvement if necessary
+	set_snpx();
 	for (int i = 0; i < segments.size(); i++) set_priors(i);
 }
 
+static bool qvalue_lt(const pair<double, int>& a, const pair<double, int>& b){
+	return a.first < b.first;
+}
+
+void SNPs::make_qindex(){
+	qorder.clear();
+	qsorted.clear();
+	for (int j = 0; j < quantannotnames.size(); j++){
+		vector<pair<double, int> > tosort;
+		for (int i = 0; i < d.size(); i++){
+			// NA is left out
+			if (!isnan(snpqannot[j][i])) tosort.push_back(make_pair(snpqannot[j][i], i));
+		}
+		stable_sort(tosort.begin(), tosort.end(), qvalue_lt);
+		vector<int> order(tosort.size());
+		vector<double> sorted(tosort.size());
+		for (int k = 0; k < tosort.size(); k++){
+			order[k] = tosort[k].second;
+			sorted[k] = tosort[k].first;
+		}
+		qorder.push_back(order);
+		qsorted.push_back(sorted);
+	}
+}
+
+void SNPs::make_qcodes(int nbins){
+	qcodes8.clear();
+	qcodes16.clear();
+	qcodevals.clear();
+	bool small = nbins < 256;
+	int n = d.size();
+	for (int j = 0; j < quantannotnames.size(); j++){
+		double minq = 0, maxq = 0;
+		bool first = true;
+		for (int i = 0; i < n; i++){
+			double q = snpqannot[j][i];
+			if (isnan(q)) continue;
+			if (first || q < minq) minq = q;
+			if (first || q > maxq) maxq = q;
+			first = false;
+		}
+		// equal-width bins over the range of the annotation
+		double width = (maxq - minq) / (double) nbins;
+		vector<unsigned short> codes(n);
+		vector<double> sums(nbins+1, 0.0);
+		vector<int> counts(nbins+1, 0);
+		for (int i = 0; i < n; i++){
+			int code = nbins;
+			double q = snpqannot[j][i];
+			if (!isnan(q)){
+				code = width > 0 ? (int) ((q - minq) / width) : 0;
+				if (code >= nbins) code = nbins-1;
+				sums[code] += q;
+				counts[code]++;
+			}
+			codes[i] = code;
+		}
+		vector<double> vals(nbins+1, 0.0);
+		for (int c = 0; c < nbins; c++){
+			if (counts[c] > 0) vals[c] = sums[c] / (double) counts[c];
+			else vals[c] = minq + (c+0.5)*width;
+		}
+		double maxerr = 0;
+		for (int i = 0; i < n; i++){
+			if (codes[i] == nbins) continue;
+			double err = fabs(snpqannot[j][i] - vals[codes[i]]);
+			if (err > maxerr) maxerr = err;
+		}
+		cout << "Quantized "<< quantannotnames[j] << " into "<< nbins << " bins, max abs error "<< maxerr << "\n";
+		qcodevals.push_back(vals);
+		if (small){
+			qcodes8.push_back(vector<unsigned char>(codes.begin(), codes.end()));
+		}
+		else qcodes16.push_back(codes);
+	}
+}
+
+template<typename T>
+static void add_qtable(vector<double>& snppri, const vector<T>& codes, const vector<double>& table){
+	int n = codes.size();
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++) snppri[i] += table[codes[i]];
+}
+
+pair<double, double> SNPs::qbins_error(){
+	// compare the priors and likelihood at the current parameters with the exact evaluation
+	set_priors();
+	vector<double> binned = snppri;
+	double llkbinned = llk();
+	if (qorder.size() != quantannotnames.size()) make_qindex();
+	useqbins = false;
+	set_priors();
+	double maxdiff = 0;
+	for (int i = 0; i < snppri.size(); i++){
+		double diff = fabs(snppri[i] - binned[i]);
+		if (diff > maxdiff) maxdiff = diff;
+	}
+	double llkexact = llk();
+	useqbins = true;
+	set_priors();
+	return make_pair(maxdiff, llkexact - llkbinned);
+}
+
+// first index in the sorted values where the exponent -b1*(q-b0) is below thresh (or, if !below,
+// at or above it). The exponent is monotone in q, so this is false and then true along the values.
+static int first_exponent(const vector<double>& vals, double b0, double b1, double thresh, bool below){
+	int lo = 0;
+	int hi = vals.size();
+	while (lo < hi){
+		int mid = (lo+hi)/2;
+		double exponent = -b1 * (vals[mid] - b0);
+		bool p = below ? exponent < thresh : exponent >= thresh;
+		if (p) hi = mid;
+		else lo = mid+1;
+	}
+	return lo;
+}
+
+void SNPs::set_snpx(){
+	//
+	// x_i for each SNP, left in snppri for set_priors(int) to normalize.
+	//
+	// Quantitative annotations contribute lambda / (1+exp(-b1*(q-b0))), thresholded: if 1/(1+exp(-x))
+	// is <0.01 or >0.99, this is 0 or lambda. This corresponds to exponent of +/- 4.59512.
+	// Along the sorted values, the SNPs that need an exp are one contiguous band, found by binary
+	// search; the ones above it get lambda and the ones below nothing.
+	//
+	(this->*snpx_fn)();
+
+	const double thresh = QUANT_THRESH;
+	for (int j = 0; j < quantparams.size(); j++){
+		double lambda = quantparams[j].lambda;
+		double b0 = quantparams[j].b0;
+		double b1 = quantparams[j].b1;
+		if (useqbins){
+			// the logistic once per code, then look it up for each SNP
+			vector<double> table;
+			qtable(j, quantparams[j], table);
+			if (qcodes8.size() > 0) add_qtable(snppri, qcodes8[j], table);
+			else add_qtable(snppri, qcodes16[j], table);
+			continue;
+		}
+		const vector<double>& vals = qsorted[j];
+		const vector<int>& order = qorder[j];
+		int nq = vals.size();
+		// [fullst, fullsp) get lambda, [bandst, bandsp) need the logistic
+		int fullst = 0, fullsp = 0, bandst = 0, bandsp = nq;
+		if (b1 > 0){
+			// exponent decreasing in q
+			bandst = first_exponent(vals, b0, b1, thresh, true);
+			bandsp = first_exponent(vals, b0, b1, -thresh, true);
+			fullst = bandsp;
+			fullsp = nq;
+		}
+		else if (b1 < 0){
+			// exponent increasing in q
+			bandst = first_exponent(vals, b0, b1, -thresh, false);
+			bandsp = first_exponent(vals, b0, b1, thresh, false);
+			fullst = 0;
+			fullsp = bandst;
+		}
+		#pragma omp parallel for schedule(static)
+		for (int k = fullst; k < fullsp; k++) snppri[order[k]] += lambda;
+		#pragma omp parallel for schedule(static)
+		for (int k = bandst; k < bandsp; k++) {
+			double exponent = -b1 * (vals[k] - b0);
+			snppri[order[k]] += lambda / (1 + exp(exponent));
+		}
+	}
+}
+
 void SNPs::set_priors_cond(){
 	set_segpriors();
 	for (int i = 0; i < segments.size(); i++) set_priors_cond(i);
 }
 
 void SNPs::set_segpriors(){
+	if (nsegannot == 0){
+		// every segment has the same prior
+		double logitprior = log(segpi) - log(1-segpi);
+		double prior = 1.0/  (1.0 + exp(-logitprior));
+		for (int i = 0; i < segments.size(); i++) segpriors[i] = prior;
+		return;
+	}
 	for (int i = 0; i < segments.size(); i++){
 		double logitprior = log(segpi) - log(1-segpi);
 		for (int j = 0; j < nsegannot; j++){
@@ -1142,26 +1944,46 @@ void SNPs::set_segpriors(){
 void SNPs::set_priors(int which){
 	//
 	// prior on SNP is exp(x_i)/ sum_j (exp(x_j))
+	// (x_i is already in snppri, from set_snpx)
 	//
 
 	pair<int, int> seg = segments[which];
 	int st = seg.first;
 	int sp = seg.second;
+	if (seginvariant[which]){
+		double lp = -log((double) (sp-st));
+		for (int i = st; i < sp; i++) snppri[i] = lp;
+		return;
+	}
+	counters.snps += sp-st;
+	counters.explog += 2*(sp-st-1);
 
-	double sumxs = d[st].get_x(lambdas, quantparams);
-	snppri[st] = sumxs;
+	double sumxs = snppri[st];
 	for (int i = st+1; i < sp ;i++) {
-		double tmpx = d[i].get_x(lambdas, quantparams);
-		snppri[i] = tmpx;
-		sumxs = sumlog(sumxs, tmpx);
+		sumxs = sumlog(sumxs, snppri[i]);
 	}
+	// x*0 is 0 for finite x and NaN otherwise, so one check covers the segment
+	double check = 0;
 	for (int i = st; i < sp ; i++) {
 		//doing this in log space
 		snppri[i] = snppri[i] - sumxs;
-		if (!isfinite(snppri[i])){
+		check += snppri[i]*0;
+	}
+	if (!isfinite(check)) nonfinite_error(st, sp, false);
+}
+
+void SNPs::nonfinite_error(int st, int sp, bool inllk){
+	// find the SNP to report
+	for (int i = st; i < sp; i++){
+		if (!inllk && !isfinite(snppri[i])){
 			cerr << "ERROR: prior for SNP "<< i << " is " << snppri[i] << "\n";
 			exit(1);
 		}
+		double tmp2add = snppri[i]+ d[i].BF;
+		if (inllk && i > st && !isfinite(tmp2add)){
+			cerr << "ERROR: likelihood of "<< tmp2add << " at SNP "<< chrname(i) << ":"<< d[i].pos << " BF:"<< d[i].BF << " "<< snppri[i] << "\n";
+			exit(1);
+		}
 	}
 }
 
@@ -1173,7 +1995,7 @@ void SNPs::set_priors_cond(int which){
 	for (int i = st; i < sp ;i++) {
 		//cout << i << " "<< d[i].get_x(lambdas) << "\n";
 		//double tmpx = exp(d[i].get_x(lambdas));
-		double tmpx = d[i].get_x_cond(lambdas, quantparams, condlambda);
+		double tmpx = get_x_cond(i, lambdas, quantparams);
 		snppri[i] = tmpx;
 		//sumxs += tmpx;
 		sumxs = sumlog(sumxs, tmpx);
@@ -1199,65 +2021,350 @@ double SNPs::llk(){
 
 double SNPs::llk(set<int> skip, bool penalize){
 	double toreturn = 0;
+	counters.llk++;
 	for (int i = 0; i < segments.size(); i++) {
 		if (skip.find(i) != skip.end()) continue;
 		toreturn += llk(i);
 	}
+	return add_penalty(toreturn, lambdas, quantparams, seglambdas, penalize);
+}
+
+double SNPs::add_penalty(double toreturn, const vector<double>& lambdas, const vector<QuantParams>& quantparams, const vector<double>& seglambdas, bool penalize){
 	if (penalize && params->ridge_penalty > 0){
 		double p = params->ridge_penalty;
-		for (vector<double>::iterator it = lambdas.begin(); it != lambdas.end(); it++)			toreturn -= p * *it * *it;
-		for (vector<QuantParams>::iterator it = quantparams.begin(); it != quantparams.end(); it++)	toreturn -= p * (it->lambda * it->lambda + it->b0 * it->b0 + it->b1 * it->b1);
+		for (vector<double>::const_iterator it = lambdas.begin(); it != lambdas.end(); it++)			toreturn -= p * *it * *it;
+		for (vector<QuantParams>::const_iterator it = quantparams.begin(); it != quantparams.end(); it++)	toreturn -= p * (it->lambda * it->lambda + it->b0 * it->b0 + it->b1 * it->b1);
 		//for (vector<QuantParams>::iterator it = quantparams.begin(); it != quantparams.end(); it++)	toreturn -= p * (it->lambda * it->lambda);
-		for (vector<double>::iterator it = seglambdas.begin(); it != seglambdas.end(); it++)	toreturn -= p * *it * *it;
+		for (vector<double>::const_iterator it = seglambdas.begin(); it != seglambdas.end(); it++)	toreturn -= p * *it * *it;
 	} else {
 		// Because quantitative annotations are defined for every SNP, sometimes the optimization
 		// gets lost tracking along a ridge where you can increase lambda indefinitely at the expense
 		// of another parameter in the logistic equation. We can stop this by putting a very small
 		// ridge penalty that is negligible for reasonable values of lambda.
-		for (vector<QuantParams>::iterator it = quantparams.begin(); it != quantparams.end(); it++)	toreturn -= lostOptimRidgePenalty * (it->lambda * it->lambda + it->b0 * it->b0 + it->b1 * it->b1);
+		for (vector<QuantParams>::const_iterator it = quantparams.begin(); it != quantparams.end(); it++)	toreturn -= lostOptimRidgePenalty * (it->lambda * it->lambda + it->b0 * it->b0 + it->b1 * it->b1);
 	}
 	//data_llk = toreturn;
 	return toreturn;
 }
 
-
-double SNPs::llk(int which){
-	double toreturn;
-	pair<int, int> seg = segments[which];
-
-	int st = seg.first;
-	int sp = seg.second;
-	double lsum = snppri[st]+ d[st].BF;
-	st++;
-	for (int i = st; i < sp ; i++){
-		double tmp2add = snppri[i]+ d[i].BF;
-		//double tmp2add = log(snppri[i])+ d[i].BF;
-		if (!isfinite(tmp2add)){
-			cerr << "ERROR: likelihood of "<< tmp2add << " at SNP "<< d[i].id << " BF:"<< d[i].BF << " "<< snppri[i] << "\n";
-			exit(1);
-		}
-		lsum  = sumlog(lsum, tmp2add);
-		//cout << tmp2add << " "<< snppri[i]<< " "<< d[i].BF << " "<< lsum << "\n";
-	}
-	if (params->finemap) return lsum;
-	toreturn = log(segpriors[which]) + lsum;
-	//cout << toreturn << "\n";
-	toreturn = sumlog(toreturn, log(1-segpriors[which]));
-
+ModelPoint SNPs::get_point(){
+	ModelPoint toreturn;
+	toreturn.segpi = segpi;
+	toreturn.seglambdas = seglambdas;
+	toreturn.lambdas = lambdas;
+	toreturn.quantparams = quantparams;
 	return toreturn;
 }
 
-double SNPs::sumlog(double logx, double logy){
-	if (logx > logy) return logx + log(1 + exp(logy-logx));
-	else return logy + log(1 + exp(logx-logy));
+void SNPs::get_point(ModelPoint& pt){
+	// as get_point(), into a point that already has the sizes, so nothing is allocated
+	pt.segpi = segpi;
+	pt.seglambdas.assign(seglambdas.begin(), seglambdas.end());
+	pt.lambdas.assign(lambdas.begin(), lambdas.end());
+	pt.quantparams.assign(quantparams.begin(), quantparams.end());
 }
 
-void SNPs::set_post(){
-	for (int i = 0; i < segments.size(); i++) set_post(i);
+void SNPs::set_point(const ModelPoint& pt){
+	segpi = pt.segpi;
+	seglambdas = pt.seglambdas;
+	lambdas = pt.lambdas;
+	quantparams = pt.quantparams;
 }
-void SNPs::set_post(int which){
-	pair<int, int> seg = segments[which];
-	int st = seg.first;
+
+void SNPs::qtable(int j, const QuantParams& qp, vector<double>& table){
+	// thresholded logistic for each -qbins code of annotation j, the last (NA) code is 0
+	const vector<double>& vals = qcodevals[j];
+	table.assign(vals.size(), 0.0);
+	for (int c = 0; c+1 < vals.size(); c++){
+		double exponent = -qp.b1 * (vals[c] - qp.b0);
+		if (exponent < -QUANT_THRESH) table[c] = qp.lambda;
+		else if (exponent < QUANT_THRESH) table[c] = qp.lambda / (1 + exp(exponent));
+	}
+}
+
+void SNPs::point_segpriors(const ModelPoint& pt, vector<double>& toreturn){
+	// as set_segpriors
+	toreturn.resize(segments.size());
+	for (int i = 0; i < segments.size(); i++){
+		double logitprior = log(pt.segpi) - log(1-pt.segpi);
+		for (int j = 0; j < nsegannot; j++){
+			if (segannot[i][j]) logitprior += pt.seglambdas[j];
+		}
+		toreturn[i] = 1.0/  (1.0 + exp(-logitprior));
+	}
+}
+
+double SNPs::point_x(int i, const ModelPoint& pt, const vector<vector<double> >& tables){
+	// x_i at a point, adding the terms in the same order as set_snpx
+	double x = get_x(i, pt.lambdas);
+	for (int j = 0; j < pt.quantparams.size(); j++){
+		if (useqbins){
+			x += tables[j][qcodes8.size() > 0 ? qcodes8[j][i] : qcodes16[j][i]];
+			continue;
+		}
+		double q = snpqannot[j][i];
+		if (isnan(q)) continue;
+		double exponent = -pt.quantparams[j].b1 * (q - pt.quantparams[j].b0);
+		if (exponent < -QUANT_THRESH) x += pt.quantparams[j].lambda;
+		else if (exponent < QUANT_THRESH) x += pt.quantparams[j].lambda / (1 + exp(exponent));
+	}
+	return x;
+}
+
+const vector<double>& SNPs::llk_batch(const ModelPoint* points, int K, const set<int>& skip, bool penalize, bool approx, BatchScratch& scratch){
+	//
+	// ln(lk) at each of the K points, the same as set_point(), set_priors() and llk(skip, penalize) for each one, but in one pass over the data: the SNPs of a segment
+	// are read once, and x for all points is kept in a small buffer while the segment is summed.
+	// approx allows the -approx and -prune approximations (the optimizer asks for them, the
+	// confidence intervals do not). The result is in scratch.lks, until its next use.
+	//
+	int nseg = segments.size();
+	#pragma omp atomic
+	counters.llk += K;
+	vector<vector<double> >& segp = scratch.segp;
+	vector<vector<vector<double> > >& tables = scratch.tables;
+	if (segp.size() < K) segp.resize(K);
+	if (tables.size() < K) tables.resize(K);
+	for (int k = 0; k < K; k++){
+		point_segpriors(points[k], segp[k]);
+		if (useqbins){
+			tables[k].resize(points[k].quantparams.size());
+			for (int j = 0; j < points[k].quantparams.size(); j++) qtable(j, points[k].quantparams[j], tables[k][j]);
+		}
+	}
+	// units (patterns, or -prune groups while the points are within its bound), or SNPs
+	bool units = usepatterns;
+	for (int k = 0; k < K && pruned; k++) units = units && approx && within_prune_bound(points[k]);
+	vector<double>& segllk = scratch.segllk;
+	vector<char>& bad = scratch.bad;
+	segllk.assign((size_t) K*nseg, 0.0);
+	bad.assign(K, 0);
+	int nthreads = 1;
+#ifdef _OPENMP
+	nthreads = scratch.nthreads > 0 ? scratch.nthreads : omp_get_max_threads();
+#endif
+	if (scratch.x.size() < nthreads){
+		scratch.x.resize(nthreads);
+		scratch.collapsed.resize(nthreads);
+	}
+	#pragma omp parallel num_threads(nthreads)
+	{
+		Span span(spans, "llk batch", K);
+		int tid = 0;
+#ifdef _OPENMP
+		tid = omp_get_thread_num();
+#endif
+		vector<double>& x = scratch.x[tid];
+		vector<char>& collapsed = scratch.collapsed[tid];
+		collapsed.assign(K, 0);
+		long nsnps = 0, nexplog = 0;
+		// nowait, so the span ends when this thread runs out of segments
+		#pragma omp for schedule(dynamic, 16) nowait
+		for (int s = 0; s < nseg; s++){
+			if (skip.find(s) != skip.end()) continue;
+			if (seginvariant[s]){
+				for (int k = 0; k < K; k++) segllk[(size_t) k*nseg+s] = invariant_llk(s, segp[k][s]);
+				continue;
+			}
+			int nexact = K;
+			for (int k = 0; k < K && approx; k++){
+				double err, R;
+				collapsed[k] = approx_seg(s, segp[k][s], segllk[(size_t) k*nseg+s], err, R);
+				if (collapsed[k]) nexact--;
+			}
+			if (nexact == 0) continue;
+			pair<int, int> range = unit_range(s, units);
+			int st = range.first;
+			int sp = range.second;
+			int len = sp-st;
+			nsnps += (long) nexact*len;
+			nexplog += (long) nexact*(4*(len-1) + (params->finemap ? 0 : 4));
+			x.resize((size_t) K*len);
+			for (int i = st; i < sp; i++){
+				for (int k = 0; k < K; k++) x[(size_t) k*len + i-st] = collapsed[k] ? 0 : unit_x(i, points[k], tables[k], units);
+			}
+			for (int k = 0; k < K; k++){
+				if (collapsed[k]) continue;
+				double* xs = &x[(size_t) k*len];
+				// as set_priors(int)
+				double sumxs = xs[0];
+				for (int i = 1; i < len; i++) sumxs = sumlog(sumxs, xs[i]);
+				double check = 0;
+				for (int i = 0; i < len; i++){
+					xs[i] = xs[i] - sumxs;
+					check += xs[i]*0;
+				}
+				// as llk(int)
+				double lsum = xs[0]+ unit_bf(st, units);
+				for (int i = 1; i < len; i++){
+					double tmp2add = xs[i]+ unit_bf(st+i, units);
+					check += tmp2add*0;
+					lsum = sumlog(lsum, tmp2add);
+				}
+				if (!isfinite(check)) bad[k] = 1;
+				if (params->finemap) segllk[(size_t) k*nseg+s] = lsum;
+				else segllk[(size_t) k*nseg+s] = sumlog(log(segp[k][s]) + lsum, log(1-segp[k][s]));
+			}
+		}
+		#pragma omp atomic
+		counters.snps += nsnps;
+		#pragma omp atomic
+		counters.explog += nexplog;
+	}
+	vector<double>& toreturn = scratch.lks;
+	toreturn.resize(K);
+	for (int k = 0; k < K; k++){
+		if (bad[k]){
+			// go through the single-point path, which reports the SNP
+			#pragma omp critical(llk_batch_bad)
+			{
+				set_point(points[k]);
+				set_priors();
+				llk(skip, penalize);
+			}
+		}
+		double total = 0;
+		for (int s = 0; s < nseg; s++){
+			if (skip.find(s) != skip.end()) continue;
+			total += segllk[(size_t) k*nseg+s];
+		}
+		toreturn[k] = add_penalty(total, points[k].lambdas, points[k].quantparams, points[k].seglambdas, penalize);
+	}
+	return toreturn;
+}
+
+const vector<double>& SNPs::llk_batch(double* pParam, const vector<double>& vals){
+	// ln(lk) with one parameter (a member of this object) set to each of the values in turn; it is
+	// left at the last one
+	vector<ModelPoint>& points = batch.points;
+	if (points.size() < vals.size()) points.resize(vals.size(), get_point());
+	for (int i = 0; i < vals.size(); i++){
+		*pParam = vals[i];
+		get_point(points[i]);
+	}
+	return llk_batch(&points[0], vals.size(), noskip, false, false, batch);
+}
+
+
+void SNPs::set_segapprox(const vector<double>& x){
+	//
+	// The segments that -approx replaces, chosen once per fit at its starting point x and then
+	// kept, so the objective the optimizer sees is one smooth function rather than switching
+	// form as the segment priors move. The error of a replaced segment is checked against the
+	// epsilon only here; report_approx gives the bound at the optimum.
+	//
+	seglbfmin.resize(segments.size());
+	seglbfmax.resize(segments.size());
+	segapprox.assign(segments.size(), 0);
+	ModelPoint pt = get_point();
+	set_x(x, pt);
+	vector<double> segp;
+	point_segpriors(pt, segp);
+	for (int s = 0; s < segments.size(); s++){
+		double lo = d[segments[s].first].BF;
+		double hi = lo;
+		for (int i = segments[s].first+1; i < segments[s].second; i++){
+			lo = min(lo, d[i].BF);
+			hi = max(hi, d[i].BF);
+		}
+		seglbfmin[s] = lo;
+		seglbfmax[s] = hi;
+		double lk, err, R;
+		approx_bound(s, params->finemap ? 1 : segp[s], lk, err, R);
+		segapprox[s] = err <= params->approx_eps;
+	}
+}
+
+bool SNPs::approx_seg(int which, double segprior, double& lk, double& err, double& R){
+	// the approximation below, for the segments chosen by set_segapprox
+	if (params->approx_eps <= 0 || !segapprox[which]) return false;
+	approx_bound(which, segprior, lk, err, R);
+	return true;
+}
+
+void SNPs::approx_bound(int which, double segprior, double& lk, double& err, double& R){
+	//
+	// The SNP priors in a segment sum to 1, so whatever the SNP-level parameters, the sum of
+	// prior*BF lies between the smallest and largest BF in the segment, and ln(lk) of the
+	// segment between f(ln BFmin) and f(ln BFmax), with f(u) = ln(segprior e^u + 1-segprior)
+	// (f(u) = u in fine-mapping). Their midpoint lk is within err, half their difference, of
+	// the exact value. R is the matching posterior that the segment holds the causal SNP, for EM.
+	//
+	double lo = seglbfmin[which];
+	double hi = seglbfmax[which];
+	double flo = lo, fhi = hi;
+	if (!params->finemap){
+		flo = sumlog(log(segprior) + lo, log(1-segprior));
+		fhi = sumlog(log(segprior) + hi, log(1-segprior));
+	}
+	err = (fhi - flo)/2;
+	lk = (fhi + flo)/2;
+	R = 1;
+	if (!params->finemap) R = (exp(log(segprior) + lo - flo) + exp(log(segprior) + hi - fhi))/2;
+}
+
+void SNPs::report_approx(){
+	// how many segments the fit replaced, and the bound on the total error at the current point
+	int ncollapsed = 0;
+	double bound = 0;
+	double approxllk = 0;
+	for (int s = 0; s < segments.size(); s++){
+		double lk, err, R;
+		if (approx_seg(s, params->finemap ? 1 : segpriors[s], lk, err, R)){
+			ncollapsed++;
+			bound += err;
+			approxllk += lk;
+		}
+		else approxllk += llk(s);
+	}
+	approxllk = add_penalty(approxllk, lambdas, quantparams, seglambdas, false);
+	cout << "Approximation: "<< ncollapsed << " of "<< segments.size() << " segments replaced by their BF range bound in the fit; at the optimum ln(lk) "<< approxllk << " vs exact "<< llk() << ", error bound "<< bound << "\n";
+}
+
+double SNPs::llk(int which){
+	if (seginvariant[which]) return invariant_llk(which, segpriors[which]);
+	int n = segments[which].second - segments[which].first;
+	counters.snps += n;
+	counters.explog += 2*(n-1) + (params->finemap ? 0 : 4);
+	return (this->*llk_fn)(which);
+}
+
+template<bool FINEMAP>
+double SNPs::llk_kernel(int which){
+	double toreturn;
+	pair<int, int> seg = segments[which];
+
+	int st = seg.first;
+	int sp = seg.second;
+	double lsum = snppri[st]+ d[st].BF;
+	double check = 0; // NaN if any term after the first is not finite
+	for (int i = st+1; i < sp ; i++){
+		double tmp2add = snppri[i]+ d[i].BF;
+		//double tmp2add = log(snppri[i])+ d[i].BF;
+		check += tmp2add*0;
+		lsum  = sumlog(lsum, tmp2add);
+		//cout << tmp2add << " "<< snppri[i]<< " "<< d[i].BF << " "<< lsum << "\n";
+	}
+	if (!isfinite(check)) nonfinite_error(st, sp, true);
+	if (FINEMAP) return lsum;
+	toreturn = log(segpriors[which]) + lsum;
+	//cout << toreturn << "\n";
+	toreturn = sumlog(toreturn, log(1-segpriors[which]));
+
+	return toreturn;
+}
+
+double SNPs::sumlog(double logx, double logy){
+	if (logx > logy) return logx + log(1 + exp(logy-logx));
+	else return logy + log(1 + exp(logx-logy));
+}
+
+void SNPs::set_post(){
+	for (int i = 0; i < segments.size(); i++) set_post(i);
+}
+void SNPs::set_post(int which){
+	pair<int, int> seg = segments[which];
+	int st = seg.first;
 	int sp = seg.second;
 	double seglk = llk(which);
 	for (int i = st; i < sp; i++){
@@ -1277,7 +2384,7 @@ void SNPs::print_segprobs(string outfile){
 		for (int i = st ; i < sp ; i++){
 			total += snppost[i];
 		}
-		out << d[st].chr << " "<< d[st].pos << " "<< d[sp].pos << " " <<  total << "\n";
+		out << chrname(st) << " "<< d[st].pos << " "<< d[sp].pos << " " <<  total << "\n";
 	}
 }
 
@@ -1290,13 +2397,110 @@ void SNPs::optimize_segpi(){
 	cout << segpi << "\n";
 }
 
-void SNPs::optimize_condlambda(){
-	double start = 0;
-	double min = -20.0;
-	double max = 20.0;
+vector<CondFit> SNPs::optimize_condlambdas(bool ci){
+	//
+	// -cond: the lambda (and CI) of each annotation with the rest of the model at the current
+	// parameters. The sums over the segments are made once at the baseline, then each annotation
+	// only reads the SNPs carrying it, and its 1-D search goes over a few numbers per segment, so
+	// the annotations are done in parallel.
+	//
+	vector<double> xa, xb, x0;
+	cond_baseline(xa, xb, x0);
+	int n = condsnps.size();
+	vector<CondFit> toreturn(n);
 	double tau = 0.001;
-	golden_section_condlambda(min, start, max, tau);
-	cout << condlambda << "\n";
+	#pragma omp parallel for schedule(dynamic)
+	for (int k = 0; k < n; k++){
+		CondTerms t = cond_terms(k, xa, xb, x0);
+		CondFit& f = toreturn[k];
+		f.lambda = golden_section_cond(t, -20.0, 0, 20.0, tau);
+		f.llk = cond_llk(t, f.lambda);
+		if (ci) f.ci = get_cis_cond(t, f.lambda);
+	}
+	for (int k = 0; k < n; k++) cout << condannotnames[k] << " " << toreturn[k].lambda << "\n";
+	return toreturn;
+}
+
+void SNPs::cond_baseline(vector<double>& xa, vector<double>& xb, vector<double>& x0){
+	// x of each SNP without the -cond annotation, and ln of the sums of the prior weights and of
+	// the prior weights times BF in each segment (as set_priors_cond(), the first sum starts at 0)
+	int nseg = segments.size();
+	x0.assign(d.size(), 0);
+	xa.assign(nseg, 0);
+	xb.assign(nseg, -numeric_limits<double>::infinity());
+	#pragma omp parallel for schedule(dynamic, 16)
+	for (int s = 0; s < nseg; s++){
+		for (int i = segments[s].first; i < segments[s].second; i++){
+			x0[i] = get_x_cond(i, lambdas, quantparams);
+			xa[s] = sumlog(xa[s], x0[i]);
+			xb[s] = sumlog(xb[s], x0[i] + d[i].BF);
+		}
+	}
+}
+
+CondTerms SNPs::cond_terms(int which, const vector<double>& xa, const vector<double>& xb, const vector<double>& x0){
+	// the sums over the carriers, and the rest as the difference from the baseline sums (summed
+	// again over the other SNPs when the carriers are most of the segment, to keep the precision)
+	const double ninf = -numeric_limits<double>::infinity();
+	const vector<int>& snps = condsnps[which];
+	CondTerms t;
+	t.rest = 0;
+	for (int s = 0; s < segments.size(); s++){
+		int st = segments[s].first;
+		int sp = segments[s].second;
+		vector<int>::const_iterator lo = lower_bound(snps.begin(), snps.end(), st);
+		vector<int>::const_iterator hi = lower_bound(lo, snps.end(), sp);
+		double lpi = log(segpriors[s]);
+		double l1mpi = log(1-segpriors[s]);
+		if (lo == hi){
+			double lsum = xb[s] - xa[s];
+			if (params->finemap) t.rest += lsum;
+			else t.rest += sumlog(lpi + lsum, l1mpi);
+			continue;
+		}
+		double a1 = ninf;
+		double b1 = ninf;
+		for (vector<int>::const_iterator it = lo; it != hi; it++){
+			a1 = sumlog(a1, x0[*it]);
+			b1 = sumlog(b1, x0[*it] + d[*it].BF);
+		}
+		double a0, b0;
+		if (a1 - xa[s] < -0.01 && b1 - xb[s] < -0.01){
+			a0 = xa[s] + log1p(-exp(a1 - xa[s]));
+			b0 = xb[s] + log1p(-exp(b1 - xb[s]));
+		}
+		else{
+			a0 = 0;
+			b0 = ninf;
+			vector<int>::const_iterator it = lo;
+			for (int i = st; i < sp; i++){
+				if (it != hi && *it == i){
+					it++;
+					continue;
+				}
+				a0 = sumlog(a0, x0[i]);
+				b0 = sumlog(b0, x0[i] + d[i].BF);
+			}
+		}
+		t.a0.push_back(a0);
+		t.a1.push_back(a1);
+		t.b0.push_back(b0);
+		t.b1.push_back(b1);
+		t.lpi.push_back(lpi);
+		t.l1mpi.push_back(l1mpi);
+	}
+	return t;
+}
+
+double SNPs::cond_llk(const CondTerms& t, double lc){
+	// ln(lk) at condlambda lc, the same as set_priors_cond() and llk()
+	double toreturn = t.rest;
+	for (int s = 0; s < t.a0.size(); s++){
+		double lsum = sumlog(t.b0[s], t.b1[s] + lc) - sumlog(t.a0[s], t.a1[s] + lc);
+		if (params->finemap) toreturn += lsum;
+		else toreturn += sumlog(t.lpi[s] + lsum, t.l1mpi[s]);
+	}
+	return toreturn;
 }
 
 void SNPs::optimize_l0(){
@@ -1309,18 +2513,27 @@ void SNPs::optimize_l0(){
 }
 
 void SNPs::GSL_optim(){
+	GSL_optim("fit");
+}
+
+void SNPs::GSL_optim(string phase){
+	optim_phase = phase;
 	GSL_optim(&GSL_llk, set<int>(), false);
 }
 
 void SNPs::GSL_optim_ridge(){
+	optim_phase = "ridge";
 	GSL_optim(&GSL_llk, set<int>(), true);
 }
 
-void SNPs::GSL_xv_optim(set<int> toskip, bool penalize){
+void SNPs::GSL_xv_optim(set<int> toskip, bool penalize, int fold){
+	ostringstream ss;
+	ss << "xv" << fold;
+	optim_phase = ss.str();
 	GSL_optim(&GSL_llk, toskip, penalize);
 }
 
-void SNPs::GSL_optim(LLKFunction* pLLKFunc, set<int> toskip, bool penalize){
+int SNPs::nparams(){
 	int nparam = nannot + (quantModelParamNum * quantparams.size());
 	if (nsegannot > 0) {
 		if (params->finemap) {
@@ -1330,6 +2543,911 @@ void SNPs::GSL_optim(LLKFunction* pLLKFunc, set<int> toskip, bool penalize){
 		// Also include the segpi parameter
 		nparam += nsegannot + 1;
 	}
+	return nparam;
+}
+
+static string file_identity(const string& path){
+	// path, size and modification time
+	ostringstream ss;
+	struct stat st;
+	ss << path;
+	if (stat(path.c_str(), &st) == 0) ss << " ("<< st.st_size << " bytes, modified "<< st.st_mtime << ")";
+	return ss.str();
+}
+
+map<string, string> SNPs::checkpoint_run(){
+	// what a checkpoint must have been written with to -resume from it
+	map<string, string> run;
+	ostringstream names, grid, seg, input, opt;
+	if (nsegannot > 0) {
+		names << "pi ";
+		for (int i = 0; i < nsegannot; i++) names << segannotnames[i] << " ";
+	}
+	for (int i = 0; i < nannot; i++) names << annotnames[i] << " ";
+	for (int i = 0; i < quantannotnames.size(); i++) {
+		names << quantannotnames[i] << "_lambda " << quantannotnames[i] << "_b0 ";
+		if (quantModelParamNum == 3) names << quantannotnames[i] << "_b1 ";
+	}
+	for (int i = 0; i < condannotnames.size(); i++) names << "cond:" << condannotnames[i] << " ";
+	run["parameters"] = names.str();
+
+	grid.precision(15);
+	for (int i = 0; i < params->V.size(); i++) grid << (i > 0 ? " " : "") << params->V[i];
+	run["V"] = grid.str();
+
+	if (params->finemap) seg << "-fine";
+	else if (params->bedseg) seg << "-bed " << file_identity(params->segment_bedfile);
+	else seg << "-k " << params->K;
+	if (params->cc) seg << " -cc";
+	for (int i = 0; i < params->dannot.size(); i++) seg << " -dists " << params->dannot[i] << ":" << file_identity(params->distmodels[i]);
+	for (int i = 0; i < params->segannot.size(); i++) seg << " -dens " << params->segannot[i] << " " << params->loquant << " " << params->hiquant;
+	if (params->qbins > 0) seg << " -qbins " << params->qbins;
+	if (params->dropchr) seg << " -drop " << params->chrtodrop;
+	for (int i = 0; i < params->regions.size(); i++) seg << " -region " << params->regions[i];
+	seg << " (" << d.size() << " SNPs, " << segments.size() << " segments)";
+	run["segmentation"] = seg.str();
+
+	input << file_identity(params->infile);
+	for (int i = 0; i < params->bedannotfiles.size(); i++) input << " " << params->bedannot[i] << ":" << file_identity(params->bedannotfiles[i]);
+	run["input"] = input.str();
+
+	opt.precision(15);
+	opt << params->optimizer << ", " << params->nstarts << " starts, ridge penalty " << params->ridge_penalty;
+	run["optimizer"] = opt.str();
+	return run;
+}
+
+void SNPs::start_x(vector<double>& x, vector<double>& step){
+	// where the optimizers start: segpi as it is and 1 for the others, with steps of 1, or -init
+	if (init_x.size() > 0){
+		x = init_x;
+		step = init_step;
+		return;
+	}
+	ModelPoint pt = get_point();
+	get_x(pt, x);
+	for (int i = (nsegannot > 0 ? 1 : 0); i < x.size(); i++) x[i] = 1;
+	step.assign(x.size(), 1.0);
+}
+
+static bool init_entry(const map<string, vector<string> >& m, const string& name, int extra, vector<double>& vals, double& lo, double& hi){
+	// the estimate (then b0 and b1 of a quantitative annotation) under name or name_ln, and
+	// the CI if both ends are numbers (else lo = hi = 0); both formats have the CI or not
+	map<string, vector<string> >::const_iterator it = m.find(name);
+	if (it == m.end()) it = m.find(name+"_ln");
+	if (it == m.end()) return false;
+	const vector<string>& tok = it->second;
+	int n = tok.size() - extra;
+	if (n != 1 && n != 3) return false;
+	vals.clear();
+	vals.push_back(atof(tok[n/2].c_str()));
+	for (int i = n; i < tok.size(); i++) vals.push_back(atof(tok[i].c_str()));
+	lo = hi = 0;
+	if (n == 3){
+		char *e1, *e2;
+		double l = strtod(tok[0].c_str(), &e1);
+		double h = strtod(tok[2].c_str(), &e2);
+		if (*e1 == 0 && *e2 == 0 && h > l){
+			lo = l;
+			hi = h;
+		}
+	}
+	return true;
+}
+
+static double init_stepsize(double v, double lo, double hi){
+	// about a standard error (a quarter of the CI for a 2 unit drop in ln(lk)), or 10% without one
+	if (hi > lo) return min(1.0, max(0.01, (hi-lo)/4));
+	return 0.1*max(1.0, fabs(v));
+}
+
+void SNPs::read_init(string file){
+	//
+	// -init: starting values from the .params or .ridgeparams of an earlier fit, matched by
+	// name, with first steps from their CIs. Parameters not in the file start where they would
+	// without -init, with the same step.
+	//
+	ifstream in(file.c_str());
+	if (!in){
+		cerr << "ERROR: cannot open "<< file << "\n";
+		exit(1);
+	}
+	map<string, vector<string> > binary, quant;
+	bool inquant = false;
+	string st;
+	while (getline(in, st)){
+		vector<string> tok;
+		stringstream ss(st);
+		string buf;
+		while (ss >> buf) tok.push_back(buf);
+		// in a .ridgeparams, cross-validation follows an empty line
+		if (tok.empty()) break;
+		if (tok[0] == "QuantParam") inquant = true;
+		else if (tok[0] != "parameter" && tok[0] != "ridgeparam:") (inquant ? quant : binary)[tok[0]] = vector<string>(tok.begin()+1, tok.end());
+	}
+	init_x.clear();
+	init_step.clear();
+	vector<double> x0, step0;
+	start_x(x0, step0);
+	vector<string> fresh;
+	vector<double> v;
+	double lo, hi;
+	if (nsegannot > 0){
+		double pi = segpi;
+		double step = 1;
+		if (init_entry(binary, "pi_region", 0, v, lo, hi) || init_entry(binary, "pi", 0, v, lo, hi)){
+			pi = v[0];
+			step = hi > lo && lo > 0 && hi < 1 ? min(1.0, max(0.01, (log(hi/(1-hi)) - log(lo/(1-lo)))/4)) : 0.5;
+		}
+		else fresh.push_back("pi_region");
+		if (!(pi > 0 && pi < 1)){
+			cerr << "ERROR: pi_region in "<< file << " is "<< pi << "\n";
+			exit(1);
+		}
+		init_x.push_back(log(pi) - log(1-pi));
+		init_step.push_back(step);
+	}
+	for (int i = 0; i < nsegannot + nannot; i++){
+		const string& name = i < nsegannot ? segannotnames[i] : annotnames[i-nsegannot];
+		if (init_entry(binary, name, 0, v, lo, hi)){
+			init_x.push_back(v[0]);
+			init_step.push_back(init_stepsize(v[0], lo, hi));
+		}
+		else{
+			fresh.push_back(name);
+			init_x.push_back(x0[init_x.size()]);
+			init_step.push_back(step0[init_step.size()]);
+		}
+	}
+	for (int i = 0; i < quantparams.size(); i++){
+		if (init_entry(quant, quantannotnames[i], 2, v, lo, hi)){
+			init_x.push_back(v[0]);
+			init_step.push_back(init_stepsize(v[0], lo, hi));
+			for (int j = 1; j < quantModelParamNum; j++){
+				init_x.push_back(v[j]);
+				init_step.push_back(init_stepsize(v[j], 0, 0));
+			}
+		}
+		else{
+			fresh.push_back(quantannotnames[i]);
+			for (int j = 0; j < quantModelParamNum; j++){
+				init_x.push_back(x0[init_x.size()]);
+				init_step.push_back(step0[init_step.size()]);
+			}
+		}
+	}
+	cout << "Initial values from "<< file << " for "<< nparams() - fresh.size() - (quantModelParamNum-1)*(quantparams.size()) << " parameter(s)";
+	if (fresh.size() > 0){
+		cout << ", not in it:";
+		for (int i = 0; i < fresh.size(); i++) cout << " "<< fresh[i];
+	}
+	cout << "\n";
+}
+
+static double log_ratio(double m1, double n1, double m0, double n0, double m, double n, double& step){
+	// ln of the posterior mass per SNP (or segment) with vs without an annotation, with one unit
+	// of mass spread evenly added to both; step is about its standard error
+	step = 1;
+	if (n1 == 0 || n0 == 0) return 0;
+	m1 += n1/n;
+	m0 += n0/n;
+	step = min(1.0, max(0.05, sqrt(1/m1 + 1/m0)));
+	return log(m1/n1) - log(m0/n0);
+}
+
+void SNPs::data_init(){
+	//
+	// -autoinit: starting values from one pass over the Bayes factors. Each segment's BF (the mean
+	// of its SNPs' BFs) gives pi by EM on the mixture of associated and null segments, and with
+	// it the posterior that each segment, and then each SNP, holds the association. A lambda
+	// starts at the ln of the posterior mass per SNP with the annotation over that without it
+	// (for quantitative annotations, above vs below the median, with b0 the median and the
+	// logistic going from 10% to 90% over the interquartile range). Segment lambdas are the
+	// same on the logit scale.
+	//
+	int nseg = segments.size();
+	int nbinary = nannot - ndistannot;
+	int nq = quantparams.size();
+	vector<double> lsbf(nseg), lsum(nseg);
+	for (int s = 0; s < nseg; s++){
+		double ls = -numeric_limits<double>::infinity();
+		for (int i = segments[s].first; i < segments[s].second; i++) ls = sumlog(ls, d[i].BF);
+		lsum[s] = ls;
+		lsbf[s] = ls - log((double) (segments[s].second - segments[s].first));
+	}
+	double pi = 0.01;
+	vector<double> post(nseg, 1.0);
+	for (int it = 0; it < 200 && !params->finemap; it++){
+		double total = 0;
+		for (int s = 0; s < nseg; s++){
+			double a = log(pi) + lsbf[s];
+			post[s] = exp(a - sumlog(a, log(1-pi)));
+			total += post[s];
+		}
+		double next = min(1-1e-6, max(1e-6, total / nseg));
+		if (fabs(next-pi) < 1e-8) break;
+		pi = next;
+	}
+	// quantiles of the quantitative annotations
+	vector<double> qmed(nq), qiqr(nq);
+	for (int j = 0; j < nq; j++){
+		vector<double> v;
+		for (int i = 0; i < d.size(); i++) if (!isnan(snpqannot[j][i])) v.push_back(snpqannot[j][i]);
+		if (v.empty()) continue;
+		nth_element(v.begin(), v.begin() + v.size()/2, v.end());
+		qmed[j] = v[v.size()/2];
+		nth_element(v.begin(), v.begin() + v.size()/4, v.end());
+		double q1 = v[v.size()/4];
+		nth_element(v.begin(), v.begin() + (3*v.size())/4, v.end());
+		qiqr[j] = v[(3*v.size())/4] - q1;
+	}
+	// posterior mass with each annotation (quantitative: above the median), and SNP counts
+	vector<double> m1(nannot + nq, 0), n1(nannot + nq, 0), m0q(nq, 0), n0q(nq, 0);
+	double mtotal = 0, ntotal = 0;
+	for (int s = 0; s < nseg; s++){
+		for (int i = segments[s].first; i < segments[s].second; i++){
+			double w = post[s] * exp(d[i].BF - lsum[s]);
+			mtotal += w;
+			ntotal++;
+			for (int j = 0; j < nbinary; j++) if (snpannot[j][i]) { m1[j] += w; n1[j]++; }
+			for (int j = 0; j < snpdistbin.size(); j++){
+				int b = snpdistbin[j][i];
+				if (b >= 0) { m1[nbinary+b] += w; n1[nbinary+b]++; }
+			}
+			for (int j = 0; j < nq; j++){
+				double q = snpqannot[j][i];
+				if (isnan(q)) continue;
+				if (q > qmed[j]) { m1[nannot+j] += w; n1[nannot+j]++; }
+				else { m0q[j] += w; n0q[j]++; }
+			}
+		}
+	}
+	init_x.clear();
+	init_step.clear();
+	double step;
+	if (nsegannot > 0){
+		init_x.push_back(log(pi) - log(1-pi));
+		init_step.push_back(min(1.0, max(0.05, sqrt(1/(nseg*pi*(1-pi))))));
+		for (int k = 0; k < nsegannot; k++){
+			double p1 = 0, c1 = 0, p0 = 0, c0 = 0;
+			for (int s = 0; s < nseg; s++){
+				if (segannot[s][k]) { p1 += post[s]; c1++; }
+				else { p0 += post[s]; c0++; }
+			}
+			double lambda = 0;
+			step = 1;
+			if (c1 > 0 && c0 > 0){
+				double f1 = (p1 + 0.5) / (c1 + 1);
+				double f0 = (p0 + 0.5) / (c0 + 1);
+				lambda = log(f1/(1-f1)) - log(f0/(1-f0));
+				step = min(1.0, max(0.05, sqrt(1/(p1+0.5) + 1/(p0+0.5))));
+			}
+			init_x.push_back(lambda);
+			init_step.push_back(step);
+		}
+	}
+	for (int j = 0; j < nannot; j++){
+		init_x.push_back(log_ratio(m1[j], n1[j], mtotal - m1[j], ntotal - n1[j], mtotal, ntotal, step));
+		init_step.push_back(step);
+	}
+	for (int j = 0; j < nq; j++){
+		init_x.push_back(log_ratio(m1[nannot+j], n1[nannot+j], m0q[j], n0q[j], mtotal, ntotal, step));
+		init_step.push_back(step);
+		init_x.push_back(qmed[j]);
+		init_step.push_back(qiqr[j] > 0 ? qiqr[j]/2 : 1);
+		if (quantModelParamNum > 2){
+			double b1 = qiqr[j] > 0 ? 4.39 / qiqr[j] : 1;
+			init_x.push_back(b1);
+			init_step.push_back(b1/2);
+		}
+	}
+	cout << "Initial values from the data: pi "<< pi;
+	ModelPoint pt = get_point();
+	set_x(init_x, pt);
+	for (int k = 0; k < nsegannot; k++) cout << ", "<< segannotnames[k] << " "<< pt.seglambdas[k];
+	for (int j = 0; j < nannot; j++) cout << ", "<< annotnames[j] << " "<< pt.lambdas[j];
+	for (int j = 0; j < nq; j++) cout << ", "<< quantannotnames[j] << " "<< pt.quantparams[j].lambda << " "<< pt.quantparams[j].b0 << " "<< pt.quantparams[j].b1;
+	cout << "\n";
+}
+
+void SNPs::get_x(ModelPoint& pt, vector<double>& x){
+	// the optimizer's parameter vector, laid out as in GSL_llk
+	x.clear();
+	if (nsegannot > 0) x.push_back(log(pt.segpi) - log(1-pt.segpi));
+	for (int i = 0; i < nsegannot; i++) x.push_back(pt.seglambdas[i]);
+	for (int i = 0; i < nannot; i++) x.push_back(pt.lambdas[i]);
+	for (int i = 0; i < pt.quantparams.size(); i++) {
+		x.push_back(pt.quantparams[i].lambda);
+		x.push_back(pt.quantparams[i].b0);
+		if (quantModelParamNum > 2) x.push_back(pt.quantparams[i].b1);
+	}
+}
+
+void SNPs::set_x(const vector<double>& x, ModelPoint& pt){
+	int curParam = 0;
+	if (nsegannot > 0) {
+		pt.segpi = 1.0 / (1.0 + exp (- x[0]));
+		curParam += 1;
+	}
+	for (int i = 0; i < nsegannot; i++) pt.seglambdas[i] = x[curParam+i];
+	curParam += nsegannot;
+	for (int i = 0; i < nannot; i++) pt.lambdas[i] = x[curParam+i];
+	curParam += nannot;
+	for (int i = 0; i < pt.quantparams.size(); i++) {
+		int index = curParam + i*quantModelParamNum;
+		pt.quantparams[i].lambda = x[index];
+		pt.quantparams[i].b0 = x[index+1];
+		if (quantModelParamNum > 2) pt.quantparams[i].b1 = x[index+2];
+	}
+}
+
+void SNPs::open_trace(){
+	if (!trace.open(params->tracefile)){
+		cerr << "ERROR: cannot open "<< params->tracefile << "\n";
+		exit(1);
+	}
+	string header = "step\titer\tnllk\tseconds\tllk\tsize";
+	if (nsegannot > 0) {
+		header += "\tpi";
+		for (int i = 0; i < nsegannot; i++) header += "\t" + segannotnames[i];
+	}
+	for (int i = 0; i < nannot; i++) header += "\t" + annotnames[i];
+	for (int i = 0; i < quantparams.size(); i++) header += "\t" + quantannotnames[i] + "_lambda\t" + quantannotnames[i] + "_b0\t" + quantannotnames[i] + "_b1";
+	trace.write(header);
+}
+
+void SNPs::print_iteration(int iter, double fval, double size){
+	if (trace.is_open()){
+		ostringstream line;
+		line.precision(10);
+		line << optim_phase << "\t" << iter << "\t" << counters.llk << "\t" << trace.elapsed() << "\t" << -fval << "\t" << size;
+		if (nsegannot > 0) {
+			line << "\t" << segpi;
+			for (int i = 0; i < nsegannot; i++) line << "\t" << seglambdas[i];
+		}
+		for (int i = 0; i < nannot; i++) line << "\t" << lambdas[i];
+		for (int i = 0; i < quantparams.size(); i++) line << "\t" << quantparams[i].lambda << "\t" << quantparams[i].b0 << "\t" << quantparams[i].b1;
+		trace.write(line.str());
+	}
+	if (params->loglevel < 1) return;
+	cout << "iteration: " << iter;
+	if (nsegannot > 0) {
+		cout << " " << segpi;
+		for (int i = 0; i < nsegannot; i++) cout <<  " " << seglambdas[i];
+	}
+	for (int i = 0; i < nannot; i++) cout << " " << lambdas[i];
+	for (int i = 0; i < quantparams.size(); i++) cout << " " << quantparams[i].lambda << "," << quantparams[i].b0 << "," << quantparams[i].b1;
+	cout << " "<< fval << " "<< size << "\n";
+}
+
+void SNPs::stop_for_time(){
+	timed_out = true;
+	cerr << "WARNING: stopped at the time limit in "<< optim_phase << ", continue with -resume\n";
+}
+
+double SNPs::halton(int i, int base){
+	double toreturn = 0;
+	double fr = 1;
+	while (i > 0){
+		fr /= (double) base;
+		toreturn += fr * (i % base);
+		i /= base;
+	}
+	return toreturn;
+}
+
+void SNPs::NM_optim(const set<int>& toskip, bool penalize){
+	//
+	// Nelder-Mead on the same parameter vector as the GSL path. With -starts, the runs from all
+	// starting points are stepped together: in each step they evaluate what they ask for in
+	// parallel, each with its own llk_batch buffers and share of the threads, and then the results
+	// are taken in start order, so the output does not depend on the threads. The first start is
+	// the usual one; the others are spread over +-2 around it along a Halton sequence.
+	//
+	int nparam = nparams();
+	if (nparam < 1) return;
+	int nstarts = params->nstarts;
+	ModelPoint start = get_point();
+	vector<double> x0, step;
+	start_x(x0, step);
+	if (params->approx_eps > 0) set_segapprox(x0);
+	vector<int> primes;
+	for (int n = 2; primes.size() < nparam; n++){
+		bool isprime = true;
+		for (int i = 0; i < primes.size() && primes[i]*primes[i] <= n; i++) if (n % primes[i] == 0) isprime = false;
+		if (isprime) primes.push_back(n);
+	}
+	vector<NMSimplex> runs;
+	for (int k = 0; k < nstarts; k++){
+		vector<double> xk = x0;
+		for (int j = 0; j < nparam && k > 0; j++) xk[j] += 4*(halton(k, primes[j]) - 0.5);
+		runs.push_back(NMSimplex(xk, step, params));
+	}
+	int ndone = 0;
+	string key = "run:"+optim_phase;
+	if (ckpt.has(key)){
+		const vector<double>& in = ckpt.get(key);
+		int pos = 0;
+		bool ok = true;
+		for (int k = 0; k < nstarts && ok; k++) ok = runs[k].restore(in, pos);
+		if (!ok || pos != in.size()){
+			cerr << "ERROR: the checkpoint of "<< optim_phase << " does not match this run\n";
+			exit(1);
+		}
+		for (int k = 0; k < nstarts; k++) if (runs[k].done) ndone++;
+		cout << "Resuming "<< optim_phase << " at iteration "<< runs[0].iter << "\n";
+	}
+
+	// teams of threads, one start each at a time, nested in the pass over the segments
+	int nteams = 1;
+	vector<BatchScratch> scratch(nstarts);
+#ifdef _OPENMP
+	int maxlevels = omp_get_max_active_levels();
+	if (nstarts > 1){
+		int nthreads = omp_get_max_threads();
+		nteams = min(nstarts, nthreads);
+		for (int k = 0; k < nstarts; k++) scratch[k].nthreads = max(1, nthreads / nteams);
+		omp_set_max_active_levels(2);
+	}
+#endif
+	// room for everything a run can ask for in a step, so the loop does not allocate
+	vector<vector<ModelPoint> > points(nstarts, vector<ModelPoint>(nparam+1, start));
+	ModelPoint current = start;
+	vector<double> fvals;
+	fvals.reserve(nparam+1);
+	while (ndone < nstarts){
+		#pragma omp parallel for schedule(dynamic, 1) num_threads(nteams) if(nteams > 1)
+		for (int k = 0; k < nstarts; k++){
+			NMSimplex& r = runs[k];
+			if (r.ask.size() == 0) continue;
+			for (int i = 0; i < r.ask.size(); i++) set_x(r.asked(i), points[k][i]);
+			llk_batch(&points[k][0], r.ask.size(), toskip, penalize, true, scratch[k]);
+		}
+		for (int k = 0; k < nstarts; k++){
+			NMSimplex& r = runs[k];
+			if (r.done) continue;
+			fvals.resize(r.ask.size());
+			for (int i = 0; i < fvals.size(); i++) fvals[i] = -scratch[k].lks[i];
+			r.tell(fvals);
+			if (r.iterated){
+				set_x(r.simplex[r.best], current);
+				set_point(current);
+				if (nstarts > 1 && params->loglevel > 0) cout << "start " << k+1 << " ";
+				print_iteration(r.iter, r.f[r.best], r.size);
+				r.next();
+			}
+			if (r.done){
+				ndone++;
+				if (!r.converged && r.iter >= params->optim_maxiter) {
+					if (nstarts > 1) cerr << "start " << k+1 << " ";
+					cerr << "WARNING: failed to converge\n";
+				}
+			}
+		}
+		bool late = ndone < nstarts && ckpt.out_of_time();
+		if (late || ckpt.due()){
+			vector<double> state;
+			for (int k = 0; k < nstarts; k++) runs[k].save(state);
+			ckpt.put(key, state);
+		}
+		if (late){
+			stop_for_time();
+			break;
+		}
+	}
+#ifdef _OPENMP
+	omp_set_max_active_levels(maxlevels);
+#endif
+
+	// keep the best run, and report how far the others ended up from it
+	int bestrun = 0;
+	for (int k = 1; k < nstarts; k++){
+		if (runs[k].f[runs[k].best] < runs[bestrun].f[runs[bestrun].best]) bestrun = k;
+	}
+	if (nstarts > 1){
+		vector<double> optima;
+		for (int k = 0; k < nstarts; k++) optima.push_back(-runs[k].f[runs[k].best]);
+		sort(optima.begin(), optima.end());
+		int nclose = 0;
+		for (int k = 0; k < nstarts; k++) if (optima[nstarts-1] - optima[k] < params->plateau_llk) nclose++;
+		cout << "Multi-start: best ln(lk) "<< optima[nstarts-1] << " from start "<< bestrun+1 << "; "<< nclose << " of "<< nstarts << " starts within "<< params->plateau_llk << "; spread of ln(lk) at the optima "<< optima[nstarts-1]-optima[0] << ":";
+		for (int k = nstarts-1; k >= 0; k--) cout << " "<< optima[k];
+		cout << "\n";
+	}
+	// leave the model at the best vertex
+	set_x(runs[bestrun].simplex[runs[bestrun].best], start);
+	set_point(start);
+	set_priors();
+	if (params->approx_eps > 0) report_approx();
+	if (pruned){
+		double grouped = llk_batch(&start, 1, toskip, penalize, true, batch)[0];
+		double exact = llk_batch(&start, 1, toskip, penalize, false, batch)[0];
+		cout << "Pruning: ln(lk) at the optimum "<< grouped << " with grouped SNPs vs exact "<< exact;
+		if (!within_prune_bound(start)) cout << " (outside the -prune slope bound, so evaluated exactly)";
+		cout << "\n";
+	}
+}
+
+bool SNPs::solve_pd(vector<double> A, vector<double> b, int n, vector<double>& x){
+	// x = A^-1 b for a symmetric positive definite n x n A (row major), by Cholesky
+	for (int j = 0; j < n; j++){
+		double diag = A[j*n+j];
+		for (int k = 0; k < j; k++) diag -= A[j*n+k]*A[j*n+k];
+		if (!(diag > 0)) return false;
+		A[j*n+j] = sqrt(diag);
+		for (int i = j+1; i < n; i++){
+			double v = A[i*n+j];
+			for (int k = 0; k < j; k++) v -= A[i*n+k]*A[j*n+k];
+			A[i*n+j] = v / A[j*n+j];
+		}
+	}
+	x = b;
+	for (int i = 0; i < n; i++){
+		for (int k = 0; k < i; k++) x[i] -= A[i*n+k]*x[k];
+		x[i] /= A[i*n+i];
+	}
+	for (int i = n-1; i >= 0; i--){
+		for (int k = i+1; k < n; k++) x[i] -= A[k*n+i]*x[k];
+		x[i] /= A[i*n+i];
+	}
+	return true;
+}
+
+double SNPs::em_segq(const vector<double>& R, set<int>& toskip, bool penalize, const vector<double>& eta, vector<double>* g, vector<double>* negH){
+	// expected complete-data ln(lk) of the segment-level parameters (logit pi, segment lambdas),
+	// and optionally its gradient and negative Hessian
+	int ns = eta.size();
+	double toreturn = 0;
+	vector<double> z(ns);
+	if (g) g->assign(ns, 0.0);
+	if (negH) negH->assign((size_t) ns*ns, 0.0);
+	for (int s = 0; s < segments.size(); s++){
+		if (toskip.find(s) != toskip.end()) continue;
+		z[0] = 1;
+		double logit = eta[0];
+		for (int k = 1; k < ns; k++){
+			z[k] = segannot[s][k-1] ? 1 : 0;
+			logit += z[k]*eta[k];
+		}
+		// ln(p) and ln(1-p), without overflow
+		double lp = logit > 0 ? -log(1 + exp(-logit)) : logit - log(1 + exp(logit));
+		double lq = lp - logit;
+		toreturn += R[s]*lp + (1-R[s])*lq;
+		if (!g) continue;
+		double ps = exp(lp);
+		for (int a = 0; a < ns; a++){
+			(*g)[a] += (R[s]-ps)*z[a];
+			for (int c = 0; c < ns; c++) (*negH)[a*ns+c] += ps*(1-ps)*z[a]*z[c];
+		}
+	}
+	if (penalize && params->ridge_penalty > 0){
+		for (int k = 1; k < ns; k++){
+			toreturn -= params->ridge_penalty*eta[k]*eta[k];
+			if (!g) continue;
+			(*g)[k] -= 2*params->ridge_penalty*eta[k];
+			(*negH)[k*ns+k] += 2*params->ridge_penalty;
+		}
+	}
+	return toreturn;
+}
+
+void SNPs::em_segfit(const vector<double>& R, set<int>& toskip, bool penalize, vector<double>& eta){
+	// Newton's method on em_segq, halving steps that do not increase it (the start can be far off)
+	int ns = eta.size();
+	vector<double> g, negH, step, trial(ns);
+	double q = em_segq(R, toskip, penalize, eta, &g, &negH);
+	for (int it = 0; it < 50; it++){
+		for (int a = 0; a < ns; a++) negH[a*ns+a] += 1e-9;
+		if (!solve_pd(negH, g, ns, step)) return;
+		double maxstep = 0;
+		for (int a = 0; a < ns; a++) maxstep = max(maxstep, fabs(step[a]));
+		if (maxstep < 1e-10) return;
+		double qt = q;
+		for (int tries = 0; tries < 40; tries++){
+			for (int a = 0; a < ns; a++) trial[a] = eta[a] + step[a];
+			qt = em_segq(R, toskip, penalize, trial, NULL, NULL);
+			if (qt >= q) break;
+			for (int a = 0; a < ns; a++) step[a] /= 2;
+		}
+		if (!(qt >= q)) return;
+		eta = trial;
+		q = em_segq(R, toskip, penalize, eta, &g, &negH);
+	}
+}
+
+double SNPs::em_pass(const vector<double>& x, set<int>& toskip, bool penalize, vector<double>& next){
+	//
+	// One pass over the data at x: returns ln(lk) and sets next to the EM update. The E-step gives,
+	// for each segment, the probability R_s that it holds a causal SNP and the distribution w_i of
+	// the causal SNP within it. With p_i the SNP priors, the expected complete-data ln(lk) has, in
+	// the lambdas, gradient sum_s R_s sum_i (w_i-p_i) a_i and Hessian -sum_s R_s Cov_p(a); both are
+	// summed in the same pass and the M-step takes a Newton step on this concave function. The
+	// segment-level parameters are a logistic regression of R_s on the segment annotations, which
+	// is cheap and fitted to convergence.
+	//
+	counters.llk++;
+	ModelPoint pt = get_point();
+	set_x(x, pt);
+	int nseg = segments.size();
+	int nbinary = nannot - ndistannot;
+	int n = nannot;
+	vector<double> segp;
+	point_segpriors(pt, segp);
+	vector<vector<double> > tables;
+	vector<double> segllk(nseg, 0.0), R(nseg, 0.0);
+
+	// gradient and Hessian summed over blocks of segments, and the blocks in order, so the
+	// result does not depend on the number of threads
+	const int block = 64;
+	int nblock = (nseg+block-1)/block;
+	vector<vector<double> > gb(nblock), Hb(nblock);
+	bool bad = false;
+	#pragma omp parallel
+	{
+		Span span(spans, "em pass");
+		vector<double> lx, m(n);
+		vector<int> idx, used;
+		long nsnps = 0, nexplog = 0;
+		#pragma omp for schedule(dynamic, 1) nowait
+		for (int b = 0; b < nblock; b++){
+			vector<double>& g = gb[b];
+			vector<double>& H = Hb[b];
+			g.assign(n, 0.0);
+			H.assign((size_t) n*n, 0.0);
+			for (int s = b*block; s < nseg && s < (b+1)*block; s++){
+				if (toskip.find(s) != toskip.end()) continue;
+				double err;
+				if (approx_seg(s, segp[s], segllk[s], err, R[s])) continue;
+				if (seginvariant[s]){
+					// no lambda enters, so only R_s is needed
+					segllk[s] = invariant_llk(s, segp[s]);
+					R[s] = params->finemap ? 1 : exp(log(segp[s]) + seginvlsum[s] - segllk[s]);
+					continue;
+				}
+				pair<int, int> range = unit_range(s, usepatterns);
+				int st = range.first;
+				int sp = range.second;
+				int len = sp-st;
+				nsnps += len;
+				nexplog += 4*(len-1) + 2*len + (params->finemap ? 0 : 6);
+				lx.resize(len);
+				for (int i = 0; i < len; i++) lx[i] = unit_x(st+i, pt, tables, usepatterns);
+				double sumxs = lx[0];
+				for (int i = 1; i < len; i++) sumxs = sumlog(sumxs, lx[i]);
+				for (int i = 0; i < len; i++) lx[i] -= sumxs;
+				double lsum = lx[0] + unit_bf(st, usepatterns);
+				for (int i = 1; i < len; i++) lsum = sumlog(lsum, lx[i] + unit_bf(st+i, usepatterns));
+				double Rs = 1;
+				if (params->finemap) segllk[s] = lsum;
+				else {
+					segllk[s] = sumlog(log(segp[s]) + lsum, log(1-segp[s]));
+					Rs = exp(log(segp[s]) + lsum - segllk[s]);
+				}
+				if (!isfinite(segllk[s])) {
+					bad = true;
+					continue;
+				}
+				R[s] = Rs;
+				used.clear();
+				for (int i = 0; i < len; i++){
+					int snp = unit_snp(st+i, usepatterns);
+					double pi = exp(lx[i]);
+					double wi = exp(lx[i] + unit_bf(st+i, usepatterns) - lsum);
+					idx.clear();
+					for (int j = 0; j < nbinary; j++) if (snpannot[j][snp]) idx.push_back(j);
+					for (int j = 0; j < snpdistbin.size(); j++) if (snpdistbin[j][snp] >= 0) idx.push_back(nbinary+snpdistbin[j][snp]);
+					for (int a = 0; a < idx.size(); a++){
+						int j = idx[a];
+						if (m[j] == 0) used.push_back(j);
+						g[j] += Rs*(wi-pi);
+						m[j] += pi;
+						for (int c = 0; c < idx.size(); c++) H[j*n+idx[c]] -= Rs*pi;
+					}
+				}
+				for (int a = 0; a < used.size(); a++){
+					for (int c = 0; c < used.size(); c++) H[used[a]*n+used[c]] += Rs*m[used[a]]*m[used[c]];
+				}
+				for (int a = 0; a < used.size(); a++) m[used[a]] = 0;
+			}
+		}
+		#pragma omp atomic
+		counters.snps += nsnps;
+		#pragma omp atomic
+		counters.explog += nexplog;
+	}
+	double total = 0;
+	for (int s = 0; s < nseg; s++){
+		if (toskip.find(s) == toskip.end()) total += segllk[s];
+	}
+	next = x;
+	if (bad) return -numeric_limits<double>::infinity();
+	total = add_penalty(total, pt.lambdas, pt.quantparams, pt.seglambdas, penalize);
+
+	// M-step for the lambdas
+	int offset = nsegannot > 0 ? nsegannot+1 : 0;
+	if (n > 0){
+		vector<double> g(n, 0.0), negH((size_t) n*n, 0.0), step;
+		for (int b = 0; b < nblock; b++){
+			for (int j = 0; j < n; j++) g[j] += gb[b][j];
+			for (size_t j = 0; j < (size_t) n*n; j++) negH[j] -= Hb[b][j];
+		}
+		for (int j = 0; j < n; j++){
+			if (penalize && params->ridge_penalty > 0){
+				g[j] -= 2*params->ridge_penalty*pt.lambdas[j];
+				negH[j*n+j] += 2*params->ridge_penalty;
+			}
+			// annotations no SNP has get no step
+			negH[j*n+j] += 1e-9;
+		}
+		if (solve_pd(negH, g, n, step)){
+			for (int j = 0; j < n; j++) next[offset+j] += step[j];
+		}
+	}
+
+	// M-step for pi and the segment lambdas
+	if (nsegannot > 0){
+		vector<double> eta(x.begin(), x.begin()+nsegannot+1);
+		em_segfit(R, toskip, penalize, eta);
+		for (int a = 0; a < eta.size(); a++) next[a] = eta[a];
+	}
+	return total;
+}
+
+void SNPs::EM_optim(set<int> toskip, bool penalize){
+	//
+	// EM (see em_pass), one pass over the data per update. With -optim squarem the updates are
+	// extrapolated with SQUAREM (Varadhan and Roland 2008, scheme S3): from x, x1 = F(x) and
+	// x2 = F(x1) give r = x1-x and v = x2-x1-r, and the next point is x - 2ar + a^2 v with
+	// a = -|r|/|v|, moved back towards plain EM (a = -1) until ln(lk) does not decrease.
+	//
+	int nparam = nparams();
+	if (nparam < 1) return;
+	bool squarem = params->optimizer == "squarem";
+	ModelPoint pt = get_point();
+	vector<double> x, fx, x1, fx1, xp, fxp, step;
+	start_x(x, step);
+	if (params->approx_eps > 0) set_segapprox(x);
+	OptimMonitor monitor(params, nparam);
+	int iter = 0;
+	string key = "run:"+optim_phase;
+	if (ckpt.has(key)){
+		const vector<double>& in = ckpt.get(key);
+		int pos = nparam+1;
+		if (in.size() < pos || !monitor.restore(in, pos) || pos != in.size()){
+			cerr << "ERROR: the checkpoint of "<< optim_phase << " does not match this run\n";
+			exit(1);
+		}
+		x.assign(in.begin(), in.begin()+nparam);
+		iter = (int) in[nparam];
+		cout << "Resuming "<< optim_phase << " at iteration "<< iter << "\n";
+	}
+	double l = em_pass(x, toskip, penalize, fx);
+	if (!isfinite(l)){
+		// report the SNP
+		set_x(x, pt);
+		set_point(pt);
+		set_priors();
+		llk(toskip, penalize);
+	}
+	int npass = 1;
+	bool converged = false;
+	while (iter < params->optim_maxiter){
+		iter++;
+		double lp = -numeric_limits<double>::infinity();
+		double l1 = lp;
+		if (squarem){
+			x1 = fx;
+			l1 = em_pass(x1, toskip, penalize, fx1);
+			npass++;
+			double rr = 0, vv = 0;
+			for (int j = 0; j < nparam; j++){
+				double r = x1[j]-x[j];
+				double v = fx1[j]-x1[j]-r;
+				rr += r*r;
+				vv += v*v;
+			}
+			double alpha = vv > 0 ? -sqrt(rr/vv) : -1;
+			if (alpha > -1) alpha = -1;
+			while (true){
+				xp.resize(nparam);
+				for (int j = 0; j < nparam; j++){
+					double r = x1[j]-x[j];
+					double v = fx1[j]-x1[j]-r;
+					xp[j] = x[j] - 2*alpha*r + alpha*alpha*v;
+				}
+				lp = em_pass(xp, toskip, penalize, fxp);
+				npass++;
+				if (alpha == -1 || (isfinite(lp) && lp >= l)) break;
+				alpha = (alpha-1)/2;
+				if (alpha > -1.01) alpha = -1;
+			}
+			// alpha = -1 is x2 = F(F(x)); if even that does not improve on x1, keep x1
+			if (!(lp >= l1) && isfinite(l1)){
+				xp = x1;
+				lp = l1;
+				fxp = fx1;
+			}
+		}
+		if (!(lp >= l)) {
+			// plain EM; with squarem F(x) = x1 has been evaluated already
+			xp = fx;
+			if (squarem){
+				lp = l1;
+				fxp = fx1;
+			}
+			else {
+				lp = em_pass(xp, toskip, penalize, fxp);
+				npass++;
+			}
+			// the Newton M-step can overshoot; halve it until ln(lk) does not decrease
+			for (int tries = 0; !(lp >= l) && tries < 30; tries++){
+				for (int j = 0; j < nparam; j++) xp[j] = (x[j]+xp[j])/2;
+				lp = em_pass(xp, toskip, penalize, fxp);
+				npass++;
+			}
+		}
+		if (!(lp >= l)) {
+			cout << "WARNING: EM update does not increase ln(lk). Ending optimization.\n";
+			break;
+		}
+		double size = 0;
+		for (int j = 0; j < nparam; j++) size = max(size, fabs(xp[j]-x[j]));
+		double gain = lp - l;
+		x.swap(xp);
+		fx.swap(fxp);
+		l = lp;
+		set_x(x, pt);
+		set_point(pt);
+		print_iteration(iter, -l, size);
+		// the steps need not shrink when the likelihood is maximized at infinity along some direction
+		if (size < params->optim_tol || gain < 0.01*params->optim_tol) { converged = true; break; }
+		if (monitor.stop(iter, -l, size)) break;
+		bool late = ckpt.out_of_time();
+		if (late || ckpt.due()){
+			vector<double> state = x;
+			state.push_back(iter);
+			monitor.save(state);
+			ckpt.put(key, state);
+		}
+		if (late){
+			stop_for_time();
+			break;
+		}
+	}
+	if (!converged && iter >= params->optim_maxiter) {
+		cerr << "WARNING: failed to converge\n";
+	}
+	cout << "EM: "<< npass << " passes over the data\n";
+	set_x(x, pt);
+	set_point(pt);
+	set_priors();
+	if (params->approx_eps > 0) report_approx();
+}
+
+void SNPs::GSL_optim(LLKFunction* pLLKFunc, set<int> toskip, bool penalize){
+	// a step finished before (-resume) is read back, and after -timelimit nothing more is done
+	if (ckpt.has(optim_phase)){
+		ModelPoint pt = get_point();
+		set_x(ckpt.get(optim_phase), pt);
+		set_point(pt);
+		set_priors();
+		cout << "Read "<< optim_phase << " from the checkpoint\n";
+		return;
+	}
+	if (timed_out) return;
+	if (params->optimizer == "em" || params->optimizer == "squarem") EM_optim(toskip, penalize);
+	else if (params->optimizer != "gsl") NM_optim(toskip, penalize);
+	else GSL_minimize(pLLKFunc, toskip, penalize);
+	if (timed_out) return;
+	ModelPoint pt = get_point();
+	vector<double> x;
+	get_x(pt, x);
+	ckpt.erase("run:"+optim_phase);
+	ckpt.put(optim_phase, x);
+}
+
+void SNPs::GSL_minimize(LLKFunction* pLLKFunc, set<int> toskip, bool penalize){
+	int nparam = nparams();
 	if (nparam < 1) return;
 	size_t iter = 0;
 	double size;
@@ -1351,25 +3469,33 @@ void SNPs::GSL_optim(LLKFunction* pLLKFunc, set<int> toskip, bool penalize){
 	//
 	// initialize parameters
 	//
+	vector<double> x0, step;
+	start_x(x0, step);
 	x = gsl_vector_alloc(nparam);
-	int curParam = 0;
-	if (nsegannot > 0) {
-		gsl_vector_set(x, curParam, log(segpi) - log(1-segpi));
-		curParam++;
-	}
-	for (; curParam < nparam; curParam++) {
-		gsl_vector_set(x, curParam, 1);
-	}
-
-	// set initial step sizes to 1
 	ss = gsl_vector_alloc(nparam);
-	gsl_vector_set_all(ss, 1.0);
+	for (int i = 0; i < nparam; i++) {
+		gsl_vector_set(x, i, x0[i]);
+		gsl_vector_set(ss, i, step[i]);
+	}
 	s = gsl_multimin_fminimizer_alloc (T, nparam);
 
-	int numIterationsStuck = 0;
-	double lastSize = 0;
-	double lastLLK = 0;
-	vector<double> llks;
+	// or carry on from the best point and simplex size of a checkpoint (GSL's simplex itself
+	// is not accessible, so this is a restart from there)
+	OptimMonitor monitor(params, nparam);
+	string key = "run:"+optim_phase;
+	if (ckpt.has(key)){
+		const vector<double>& in = ckpt.get(key);
+		int pos = nparam+2;
+		if (in.size() < pos || !monitor.restore(in, pos) || pos != in.size()){
+			cerr << "ERROR: the checkpoint of "<< optim_phase << " does not match this run\n";
+			exit(1);
+		}
+		for (int i = 0; i < nparam; i++) gsl_vector_set(x, i, in[i]);
+		iter = (size_t) in[nparam];
+		gsl_vector_set_all(ss, max(in[nparam+1], params->optim_tol));
+		cout << "Resuming "<< optim_phase << " at iteration "<< iter << "\n";
+	}
+
 	gsl_multimin_fminimizer_set (s, &lm, x, ss);
 	do
 	{
@@ -1382,47 +3508,31 @@ void SNPs::GSL_optim(LLKFunction* pLLKFunc, set<int> toskip, bool penalize){
 		}
 		
 		size = gsl_multimin_fminimizer_size(s);
-		status = gsl_multimin_test_size (size, 0.001);
+		status = gsl_multimin_test_size (size, params->optim_tol);
 		//cout << iter << " "<< iter %10 << "\n";
 		//if (iter % 20 < 1 || iter < 20){
-		cout << "iteration: " << iter;
-		if (nsegannot > 0) {
-			cout << " " << segpi;
-			for (int i = 0; i < nsegannot; i++) cout <<  " " << seglambdas[i];
-		}
-		for (int i = 0; i < nannot; i++) cout << " " << lambdas[i];
-		for (int i = 0; i < quantparams.size(); i++) cout << " " << quantparams[i].lambda << "," << quantparams[i].b0 << "," << quantparams[i].b1;
-		cout << " "<< s->fval << " "<< size << "\n" << flush;
-
-		llks.push_back(s->fval);
-		// Stop optimisation if the rate of improvement of LLK is too low
-		if (iter > 200) {
-			double llkDiff = abs(llks[iter-1] - llks[iter-201]);
-			// Require that LLK improve at least 1 unit over the above number of iterations
-			if (llkDiff < 0.2) {
-				cout << "WARNING: optimization improvement is lower than 0.2 unit LLK over 200 iterations. Ending optimization.\n";
-				break;
-			}
+		print_iteration(iter, s->fval, size);
+		if (monitor.stop(iter, s->fval, size)) break;
+		bool late = status == GSL_CONTINUE && ckpt.out_of_time();
+		if (late || ckpt.due()){
+			vector<double> state;
+			for (int i = 0; i < nparam; i++) state.push_back(gsl_vector_get(s->x, i));
+			state.push_back(iter);
+			state.push_back(size);
+			monitor.save(state);
+			ckpt.put(key, state);
 		}
-		if (s->fval == lastLLK && size == lastSize) {
-			numIterationsStuck++;
-			if (numIterationsStuck > (2*nparam + 10)) {
-				cout << "WARNING: optimization stuck at the same values for too many iterations (" << (2*nparam + 10) << ").\n";
-				cout << "WARNING: failed to converge\n";
-				break;
-			}
-		} else {
-			numIterationsStuck = 0;
-			lastSize = size;
-			lastLLK = s->fval;
+		if (late){
+			stop_for_time();
+			break;
 		}
 	}
-	while (status == GSL_CONTINUE && iter < 5000);
-	if (iter > 4999) {
+	while (status == GSL_CONTINUE && iter < params->optim_maxiter);
+	if (iter >= params->optim_maxiter) {
 		cerr << "WARNING: failed to converge\n";
 		//exit(1);
 	}
-	curParam = 0;
+	int curParam = 0;
 	if (nsegannot > 0) {
 		segpi = 1.0 /  (1.0 + exp (- gsl_vector_get(s->x, curParam)));
 		curParam++;
@@ -1465,7 +3575,7 @@ int SNPs::golden_section_segpi(double min, double guess, double max, double tau)
 
         segpi =  1.0  / ( 1.0 + exp(-guess));
         double f_guess = -llk();
-        cout << x << " " <<  guess << " "<< segpi << " "<< f_x << " "<< f_guess <<  "\n";
+        if (params->loglevel > 1) cout << x << " " <<  guess << " "<< segpi << " "<< f_x << " "<< f_guess <<  "\n";
         if (f_x < f_guess){
                 if ( (max-guess) > (guess-min) )        return golden_section_segpi(guess, x, max, tau);
                 else return golden_section_segpi(min, x, guess, tau);
@@ -1476,72 +3586,47 @@ int SNPs::golden_section_segpi(double min, double guess, double max, double tau)
         }
 }
 
-int SNPs::golden_section_condlambda(double min, double guess, double max, double tau){
+double SNPs::golden_section_cond(const CondTerms& t, double min, double guess, double max, double tau){
         double x;
         if ( (max - guess) > (guess - min)) x = guess + resphi *( max - guess);
         else x = guess - resphi *(guess-min);
-        if (fabs(max-min) < tau * (fabs(guess)+fabs(max))) {
-                double new_segpi = (min+max)/2;
-                condlambda =  new_segpi;
-                set_priors_cond();
-                data_llk = llk();
-                return 0;
-        }
-
-        condlambda= x;
-        set_priors_cond();
-        double f_x = -llk();
-
-        condlambda = guess;
-        set_priors_cond();
-        double f_guess = -llk();
+        if (fabs(max-min) < tau * (fabs(guess)+fabs(max))) return (min+max)/2;
 
-        cout << x << " " <<  guess << " "<< f_x << " "<< f_guess  << " "<< max << " "<< min << "\n";
+        double f_x = -cond_llk(t, x);
+        double f_guess = -cond_llk(t, guess);
         if (f_x < f_guess){
-                if ( (max-guess) > (guess-min) )        return golden_section_condlambda(guess, x, max, tau);
-                else return golden_section_condlambda(min, x, guess, tau);
+                if ( (max-guess) > (guess-min) )        return golden_section_cond(t, guess, x, max, tau);
+                else return golden_section_cond(t, min, x, guess, tau);
         }
         else{
-                if ( (max - guess) > (guess - min)  ) return golden_section_condlambda(min, guess, x, tau);
-                else return golden_section_condlambda(x, guess, max, tau);
+                if ( (max - guess) > (guess - min)  ) return golden_section_cond(t, min, guess, x, tau);
+                else return golden_section_cond(t, x, guess, max, tau);
         }
 }
 
-int SNPs::golden_section_condlambda_ci(double min, double guess, double max, double tau, double target){
+int SNPs::golden_section_cond_ci(const CondTerms& t, double min, double guess, double max, double tau, double target, double* pParam){
         double x;
-
         if ( (max - guess) > (guess - min)) x = guess + resphi *( max - guess);
         else x = guess - resphi *(guess-min);
         if (fabs(max-min) < tau * (fabs(guess)+fabs(max))) {
-                double new_segpi = (min+max)/2;
-                condlambda =  new_segpi;
-                set_priors_cond();
-                data_llk = llk();
-                double tmpdiff = data_llk- target;
+                *pParam = (min+max)/2;
+                double tmpdiff = cond_llk(t, *pParam) - target;
                 double d2 = tmpdiff*tmpdiff;
                 if (d2 > tau) return 1;
                 else return 0;
         }
 
-        condlambda = x;
-        set_priors_cond();
-        double f_x = llk()-target;
+        double f_x = cond_llk(t, x)-target;
         f_x = f_x*f_x;
-       // double x_llk = llk();
-
-        condlambda = guess;
-        set_priors_cond();
-        double f_guess = llk()-target;
+        double f_guess = cond_llk(t, guess)-target;
         f_guess = f_guess*f_guess;
-       // double guess_llk = llk();
-        cout << x << " " <<  guess << " "<< f_x << " "<< f_guess  << " "<< max << " "<< min << "\n";
         if (f_x < f_guess){
-                if ( (max-guess) > (guess-min) )        return golden_section_condlambda_ci(guess, x, max, tau, target);
-                else return golden_section_condlambda_ci(min, x, guess, tau, target);
+                if ( (max-guess) > (guess-min) )        return golden_section_cond_ci(t, guess, x, max, tau, target, pParam);
+                else return golden_section_cond_ci(t, min, x, guess, tau, target, pParam);
         }
         else{
-                if ( (max - guess) > (guess - min)  ) return golden_section_condlambda_ci(min, guess, x, tau, target);
-                else return golden_section_condlambda_ci(x, guess, max, tau, target);
+                if ( (max - guess) > (guess - min)  ) return golden_section_cond_ci(t, min, guess, x, tau, target, pParam);
+                else return golden_section_cond_ci(t, x, guess, max, tau, target, pParam);
         }
 }
 
@@ -1561,18 +3646,16 @@ int SNPs::golden_section_ci(double min, double guess, double max, double tau, do
 		else return 0;
 	}
 
-	*pParam = x;
-	set_priors();
-	double f_x = llk()-target;
+	vector<double> vals;
+	vals.push_back(x);
+	vals.push_back(guess);
+	const vector<double>& lks = llk_batch(pParam, vals);
+	double f_x = lks[0]-target;
 	f_x = f_x*f_x;
-	// double x_llk = llk();
 
-	*pParam = guess;
-	set_priors();
-	double f_guess = llk()-target;
+	double f_guess = lks[1]-target;
 	f_guess = f_guess*f_guess;
-	// double guess_llk = llk();
-	cout << x << " " <<  guess << " "<< f_x << " "<< f_guess  << " "<< max << " "<< min << "\n";
+	if (params->loglevel > 1) cout << x << " " <<  guess << " "<< f_x << " "<< f_guess  << " "<< max << " "<< min << "\n";
 	if (f_x < f_guess){
 		if ( (max-guess) > (guess-min) )        return golden_section_ci(guess, x, max, tau, target, pParam);
 		else return golden_section_ci(min, x, guess, tau, target, pParam);
@@ -1676,17 +3759,17 @@ int SNPs::golden_section_segpi_ci(double min, double guess, double max, double t
         }
         else if (*nit > 50) return 1;
 
-        segpi = 1.0  / ( 1.0 + exp(-x));
-        set_priors();
-        double f_x = llk()-target;
+        vector<double> vals;
+        vals.push_back(1.0  / ( 1.0 + exp(-x)));
+        vals.push_back(1.0  / ( 1.0 + exp(-guess)));
+        const vector<double>& lks = llk_batch(&segpi, vals);
+        double f_x = lks[0]-target;
         f_x = f_x*f_x;
 
-        segpi =  1.0  / ( 1.0 + exp(-guess));
-        set_priors();
-        double f_guess = llk()- target;
+        double f_guess = lks[1]- target;
         f_guess = f_guess*f_guess;
 
-        cout << x << " " <<  guess << " "<< f_x << " "<< f_guess <<  " "<< max << " "<< min << " "<< target << "\n";
+        if (params->loglevel > 1) cout << x << " " <<  guess << " "<< f_x << " "<< f_guess <<  " "<< max << " "<< min << " "<< target << "\n";
         if (f_x < f_guess){
                 if ( (max-guess) > (guess-min) )        return golden_section_segpi_ci(guess, x, max, tau, target, nit);
                 else return golden_section_segpi_ci(min, x, guess, tau, target, nit);
@@ -1709,14 +3792,13 @@ int SNPs::golden_section_l0(double min, double guess, double max, double tau){
                 return 0;
         }
 
-        lambdas[0] = x;
-        set_priors();
-        double f_x = -llk();
-
-        lambdas[0] = guess;
-        set_priors();
-        double f_guess = -llk();
-        cout << x << " " <<  guess << " "<< segpi << " "<< f_x << " "<< f_guess <<  " "<< max << " "<< min << "\n";
+        vector<double> vals;
+        vals.push_back(x);
+        vals.push_back(guess);
+        const vector<double>& lks = llk_batch(&lambdas[0], vals);
+        double f_x = -lks[0];
+        double f_guess = -lks[1];
+        if (params->loglevel > 1) cout << x << " " <<  guess << " "<< segpi << " "<< f_x << " "<< f_guess <<  " "<< max << " "<< min << "\n";
         if (f_x < f_guess){
                 if ( (max-guess) > (guess-min) )        return golden_section_l0(guess, x, max, tau);
                 else return golden_section_l0(min, x, guess, tau);
@@ -10,16 +10,90 @@
 
 #include "SNP.h"
 #include "fgwas_params.h"
+#include "TabixIndex.h"
+#include "NMSimplex.h"
+#include "Checkpoint.h"
+#include "TraceWriter.h"
+#include "Profile.h"
 using namespace std;
 
 typedef double LLKFunction(const gsl_vector *, void *);
 
+class SNPs;
+
+// one point in parameter space, for evaluating several at once
+struct ModelPoint{
+	double segpi;
+	vector<double> seglambdas;
+	vector<double> lambdas;
+	vector<QuantParams> quantparams;
+};
+
+// buffers of llk_batch, sized by the first evaluation and kept, so that later ones do not allocate
+struct BatchScratch{
+	vector<vector<double> > segp; // segment priors of each point
+	vector<vector<vector<double> > > tables; // -qbins tables of each point
+	vector<double> segllk; // point x segment
+	vector<char> bad;
+	vector<vector<double> > x; // per thread: x of the units of a segment at each point
+	vector<vector<char> > collapsed; // per thread
+	vector<ModelPoint> points; // for llk_batch(pParam, vals)
+	vector<double> lks; // the result
+	int nthreads; // threads for the pass over the segments, 0 for all
+	BatchScratch() : nthreads(0) {}
+};
+
+// ln(lk) as a function of the lambda of one -cond annotation, with the rest of the model fixed:
+// for each segment with SNPs carrying it, ln of the sums of the prior weights (a) and of the
+// prior weights times BF (b) over the SNPs without (0) and with (1) the annotation
+struct CondTerms{
+	double rest; // ln(lk) of the other segments
+	vector<double> a0, a1, b0, b1, lpi, l1mpi;
+};
+
+// estimate, CI and ln(lk) for one -cond annotation
+struct CondFit{
+	double lambda, llk;
+	pair<pair<int, int>, pair<double, double> > ci;
+};
+
+// reads SNP identifiers, Z and V back from the input file, going forward through it as SNPs are printed in order
+class SNPOutputReader{
+public:
+	SNPOutputReader(SNPs*);
+	~SNPOutputReader();
+	void get(int snp, string& id, double& z, double& v);
+private:
+	SNPs* snps;
+	igzstream* in;
+	TabixReader regionin;
+	bool byregion;
+	long nread; // lines read from the input so far
+	int run;
+	string st;
+	vector<string> line;
+	void open();
+};
+
 class SNPs{
 public:
 	SNPs();
 	SNPs(Fgwas_params *);
 	Fgwas_params *params;
 	vector<SNP> d;
+	void reserve_snps(size_t n);
+
+	//annotations of the SNPs, one array per annotation indexed by SNP
+	vector<vector<char> > snpannot; // binary annotations, 0 or 1
+	vector<vector<short> > snpdistbin; // for each distance model, the index of the SNP's bin among all distance annotations (-1 if none)
+	vector<vector<double> > snpqannot; // quantitative annotations, NaN if NA
+	vector<float> snpdens; // with -dens, the annotation the segments are classified by
+	vector<int> snpchunk; // with -fine, the SEGNUMBER of each SNP
+	void read_annots(const vector<string>& line, const vector<int>& annot_index, const vector<int>& dannot_index, const vector<int>& qannot_index);
+	short find_distbin(int model, int dist);
+	bool get_annot(int i, int j); // binary annotations, then distance annotations
+	double get_x(int i, const vector<double>& lambda); // binary and distance annotations, see set_snpx for quantitative ones
+	double get_x_cond(int i, const vector<double>& lambda, const vector<QuantParams>& qparams);
 
 	//snp annotations
 	vector<double> snppri;
@@ -27,14 +101,50 @@ public:
 	vector<double> lambdas;
 	vector<string> annotnames;
 	vector<string> chrnames;
+
+	//chromosome names are stored once, SNPs keep codes
+	vector<string> chrcodes;
+	map<string, int> chrcodeindex;
+	int intern_chr(const string&);
+	const string& chrname(int i) { return chrcodes[d[i].chr]; }
+
+	//SNP identifiers, Z and V are not kept, only where the SNPs are in the input
+	vector<pair<int, long> > inputruns; // first SNP of each run of consecutive input lines, and its line
+	int rsindex, chrindex, posindex, zindex, mafindex, Nindex, Ncaseindex, Ncontrolindex, seindex;
+	bool open_regions(TabixReader&);
+	double input_v(const vector<string>& line);
+
+	//Z-scores and variances, one entry per SNP, while computing Bayes factors
+	vector<double> Z, V;
+	bool override_z; // Bayes factors were read from the LNBF column
+	bool override_v; // V is SE^2
+	void set_BFs(const vector<double>& W); // reads Z and V from the input if they are not loaded
+	void read_zv();
+	void free_zv();
 	
 	int quantModelParamNum; // 3 or 2, for a 3- or 2-parameter model
 	vector<QuantParams> quantparams;
 	vector<string> quantannotnames;
+	// for each quantitative annotation, the SNPs where it is defined sorted by value
+	vector<vector<int> > qorder;
+	vector<vector<double> > qsorted;
+	void make_qindex();
+	// with -qbins, each quantitative annotation is a code per SNP (8-bit if it fits), the last code is NA
+	vector<vector<unsigned char> > qcodes8;
+	vector<vector<unsigned short> > qcodes16;
+	vector<vector<double> > qcodevals; // value of each code (the mean of the SNPs in it)
+	bool useqbins;
+	void make_qcodes(int nbins);
+	pair<double, double> qbins_error(); // max abs difference in ln(prior) and in ln(lk) against the exact values
 	
 	int nannot;
 	vector<vector<pair<int, int> > > dmodels; // hold the distance models
+	vector<vector<DistBin> > dbins; // the distance models sorted for lookup
+	int ndistannot;
 	double condlambda; //for conditional analysis
+	vector<string> condannotnames; // the annotations tested with -cond
+	vector<vector<int> > condsnps; // the SNPs carrying each of them
+	void read_condannots(const vector<string>& line, const vector<int>& condindex, vector<char>& binary, bool strict);
 	//segment annotations
 	double segpi;
 	int nsegannot;
@@ -44,6 +154,33 @@ public:
 	vector<double> seglambdas;
 	vector<vector<bool> > segannot;
 	vector<double> segpriors;
+	vector<double> seglbfmin, seglbfmax; // range of log BF in each segment, for -approx
+	vector<char> segapprox; // segments -approx replaces in the current fit
+
+	// Without quantitative annotations, SNPs in a segment with the same annotations have the
+	// same prior, so the likelihood only needs, for each distinct pattern, a SNP that has it,
+	// the number of SNPs and their summed BF. Optimizer evaluations run over these units.
+	bool usepatterns;
+	bool pruned; // -prune: units group SNPs with different quantitative annotations
+	vector<int> segpatst; // units of segment s are segpatst[s] to segpatst[s+1]
+	vector<int> patsnp;
+	vector<double> patlogn, patbf; // ln(count) and ln(mean BF) of each pattern
+	vector<double> patq; // with -prune, the quantitative annotations of each unit
+	void make_patterns();
+	bool within_prune_bound(const ModelPoint& pt);
+	// segments with a single pattern have uniform SNP priors whatever the lambdas, and
+	// ln(sum prior*BF) is just ln(mean BF), cached here
+	vector<char> seginvariant;
+	vector<double> seginvlsum;
+	double invariant_llk(int which, double segprior);
+	pair<int, int> unit_range(int which, bool units);
+	double unit_x(int u, const ModelPoint& pt, const vector<vector<double> >& tables, bool units);
+	double unit_bf(int u, bool units);
+	int unit_snp(int u, bool units);
+	void set_segapprox(const vector<double>& x);
+	bool approx_seg(int which, double segprior, double& lk, double& err, double& R);
+	void approx_bound(int which, double segprior, double& lk, double& err, double& R);
+	void report_approx();
 	void init_segpriors();
 	void set_segpriors();
 
@@ -51,6 +188,9 @@ public:
 	void append_dannotnames(string, vector<pair<int, int> >);
 	vector<pair<int, int> > read_dmodel(string);
 
+	//annotations from .bed files
+	void append_bedannots(string, string);
+
 	//10-fold cross-validation
 	vector<double> cross10(bool penalize, ostringstream& outstr, string outfileSNPs, string outfileSegs);
 	vector<set<int> > make_cross10();
@@ -62,7 +202,7 @@ public:
 	void print();
 	void print(string, string);
 	void print_header(ogzstream& outSNP, ogzstream& outSeg);
-	void print(int segnum, ogzstream& outSNP, ogzstream& outSeg);
+	void print(int segnum, ogzstream& outSNP, ogzstream& outSeg, SNPOutputReader&);
 
 	void make_segments(int);
 	void make_segments(string);
@@ -71,6 +211,14 @@ public:
 	void make_segments_finemap();
 	void print_segments();
 	void print_chrsegments();
+	void set_snpx();
+	// kernels specialized on the model configuration, picked once by choose_kernels()
+	void choose_kernels();
+	template<int NBINARY, int NDIST> void snpx_kernel();
+	template<bool FINEMAP> double llk_kernel(int);
+	void (SNPs::*snpx_fn)();
+	double (SNPs::*llk_fn)(int);
+	void nonfinite_error(int st, int sp, bool inllk);
 	void set_priors(int);
 	void set_priors();
 	void set_priors_cond(int);
@@ -79,34 +227,83 @@ public:
 	void set_post(int);
 	void set_post();
 	void GSL_optim();
+	void GSL_optim(string phase);
 	void GSL_optim(LLKFunction* llkFunc, set<int> toskip, bool penalize);
-	void GSL_xv_optim(set<int>, bool);
+	void GSL_minimize(LLKFunction* llkFunc, set<int> toskip, bool penalize);
+	void GSL_xv_optim(set<int>, bool, int fold);
 	void GSL_optim_ridge();
+	//checkpoints: each optimization is saved under the name of its step
+	Checkpoint ckpt;
+	string optim_phase;
+	bool timed_out; // stopped by -timelimit
+	void stop_for_time();
+	map<string, string> checkpoint_run();
+	//-trace
+	TraceWriter trace;
+	void open_trace();
+	//-profile
+	WorkCounters counters;
+	Profiler prof;
+	//-chrometrace
+	SpanTracer spans;
+	bool next_ci(vector<pair<pair<int, int>, pair<double, double> > >& cis);
+	void done_ci(const vector<pair<pair<int, int>, pair<double, double> > >& cis);
+	void NM_optim(const set<int>& toskip, bool penalize);
+	static double halton(int i, int base);
+	void EM_optim(set<int> toskip, bool penalize);
+	static bool solve_pd(vector<double> A, vector<double> b, int n, vector<double>& x);
+	double em_segq(const vector<double>& R, set<int>& toskip, bool penalize, const vector<double>& eta, vector<double>* g, vector<double>* negH);
+	void em_segfit(const vector<double>& R, set<int>& toskip, bool penalize, vector<double>& eta);
+	double em_pass(const vector<double>& x, set<int>& toskip, bool penalize, vector<double>& next);
+	int nparams();
+	vector<double> init_x, init_step; // -init
+	void read_init(string);
+	void data_init();
+	void start_x(vector<double>& x, vector<double>& step);
+	void get_x(ModelPoint& pt, vector<double>& x);
+	void set_x(const vector<double>& x, ModelPoint& pt);
+	void print_iteration(int iter, double fval, double size);
 	double llk(int);
 	double llk();
 	double llk(set<int> skip, bool penalize);
+	double add_penalty(double, const vector<double>& lambdas, const vector<QuantParams>& qparams, const vector<double>& seglambdas, bool penalize);
+
+	//evaluating several points in one pass over the data
+	ModelPoint get_point();
+	void get_point(ModelPoint&);
+	void set_point(const ModelPoint&);
+	BatchScratch batch;
+	const set<int> noskip;
+	const vector<double>& llk_batch(const ModelPoint* points, int K, const set<int>& skip, bool penalize, bool approx, BatchScratch& scratch);
+	const vector<double>& llk_batch(double* pParam, const vector<double>& vals);
+	void qtable(int j, const QuantParams&, vector<double>& table);
+	double point_x(int i, const ModelPoint& pt, const vector<vector<double> >& tables);
+	void point_segpriors(const ModelPoint& pt, vector<double>& toreturn);
 	double llk_ridge();
 
 	double data_llk;
 	double sumlog(double, double);
 	void print_segprobs(string);
 	void optimize_segpi();
-	void optimize_condlambda();
+	vector<CondFit> optimize_condlambdas(bool ci);
+	void cond_baseline(vector<double>& xa, vector<double>& xb, vector<double>& x0);
+	CondTerms cond_terms(int which, const vector<double>& xa, const vector<double>& xb, const vector<double>& x0);
+	double cond_llk(const CondTerms&, double);
 	void optimize_l0();
 	vector<pair<pair<int, int>, pair<double, double> > > get_cis();
 	pair<pair<int, int>, pair<double, double> > get_cis_segpi();
-	pair<pair<int, int>, pair<double, double> > get_cis_condlambda();
+	pair<pair<int, int>, pair<double, double> > get_cis_cond(const CondTerms&, double);
 	pair<pair<int, int>, pair<double, double> > get_cis_param(double* pParam);
 // 	pair<pair<int, int>, pair<double, double> > get_cis_lambda(int);
 // 	pair<pair<int, int>, pair<double, double> > get_cis_seglambda(int);
 
 	int golden_section_segpi(double, double, double, double);
-	int golden_section_condlambda(double, double, double, double);
+	double golden_section_cond(const CondTerms&, double, double, double, double);
 	int golden_section_segpi_ci(double, double, double, double, double, int *);
 	int golden_section_ci(double, double, double, double, double, double* pParam);
 // 	int golden_section_lambda_ci(double, double, double, double, int, double);
 // 	int golden_section_seglambda_ci(double, double, double, double, int, double);
-	int golden_section_condlambda_ci(double, double, double, double, double);
+	int golden_section_cond_ci(const CondTerms&, double, double, double, double, double, double*);
 	int golden_section_l0(double, double, double, double);
 
 	void check_input();
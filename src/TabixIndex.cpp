@@ -0,0 +1,398 @@
+/*
+ * TabixIndex.cpp
+ *
+ *  Index formats are described in the SAM/BAM specification (CSI) and the
+ *  tabix documentation (.tbi). Both are BGZF-compressed, so they can be read
+ *  with zlib directly.
+ */
+
+#include "TabixIndex.h"
+#include <algorithm>
+#include <sstream>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+using namespace std;
+
+static int32_t read_int32(const vector<unsigned char>& buf, size_t& at){
+	if (at + 4 > buf.size()){
+		cerr << "ERROR: truncated index file\n";
+		exit(1);
+	}
+	uint32_t toreturn = 0;
+	for (int i = 3; i >= 0; i--) toreturn = (toreturn << 8) | buf[at+i];
+	at += 4;
+	return (int32_t) toreturn;
+}
+
+static uint64_t read_uint64(const vector<unsigned char>& buf, size_t& at){
+	if (at + 8 > buf.size()){
+		cerr << "ERROR: truncated index file\n";
+		exit(1);
+	}
+	uint64_t toreturn = 0;
+	for (int i = 7; i >= 0; i--) toreturn = (toreturn << 8) | buf[at+i];
+	at += 8;
+	return toreturn;
+}
+
+TabixIndex::TabixIndex(){
+	format = 0; col_seq = 1; col_beg = 4; col_end = 5; meta = '#'; skip = 0;
+	min_shift = 14;
+	depth = 5;
+	csi = false;
+}
+
+bool TabixIndex::load(string indexfile){
+	gzFile in = gzopen(indexfile.c_str(), "rb");
+	if (in == NULL) return false;
+	vector<unsigned char> buf;
+	unsigned char tmp[65536];
+	int nread;
+	while ((nread = gzread(in, tmp, sizeof(tmp))) > 0) buf.insert(buf.end(), tmp, tmp+nread);
+	gzclose(in);
+	if (buf.size() < 4){
+		cerr << "ERROR: "<< indexfile << " is not a tabix or CSI index\n";
+		exit(1);
+	}
+	size_t at = 4;
+	string magic(buf.begin(), buf.begin()+4);
+	vector<unsigned char> aux;
+	if (magic == string("TBI\1", 4)) csi = false;
+	else if (magic == string("CSI\1", 4)) {
+		csi = true;
+		min_shift = read_int32(buf, at);
+		depth = read_int32(buf, at);
+		int laux = read_int32(buf, at);
+		if (laux > 0) aux.assign(buf.begin()+at, buf.begin()+at+laux);
+		at += laux;
+	}
+	else{
+		cerr << "ERROR: "<< indexfile << " is not a tabix or CSI index\n";
+		exit(1);
+	}
+
+	// .tbi keeps the tabix header before the bins, CSI keeps it in aux
+	int nref = 0;
+	vector<unsigned char> header;
+	size_t hat = 0;
+	if (!csi) {
+		nref = read_int32(buf, at);
+		header = buf;
+		hat = at;
+	}
+	else header = aux;
+	names.clear();
+	tids.clear();
+	if (header.size() >= hat + 28){
+		format = read_int32(header, hat);
+		col_seq = read_int32(header, hat);
+		col_beg = read_int32(header, hat);
+		col_end = read_int32(header, hat);
+		meta = read_int32(header, hat);
+		skip = read_int32(header, hat);
+		int lnm = read_int32(header, hat);
+		string name;
+		for (int i = 0; i < lnm; i++){
+			char c = header[hat+i];
+			if (c == '\0') {
+				tids[name] = names.size();
+				names.push_back(name);
+				name.clear();
+			}
+			else name += c;
+		}
+		hat += lnm;
+	}
+	if (!csi) at = hat;
+	else nref = read_int32(buf, at);
+
+	bins.clear();
+	linear.clear();
+	bins.resize(nref);
+	linear.resize(nref);
+	for (int i = 0; i < nref; i++){
+		int nbin = read_int32(buf, at);
+		for (int j = 0; j < nbin; j++){
+			unsigned int bin = (unsigned int) read_int32(buf, at);
+			Bin b;
+			b.loffset = 0;
+			if (csi) b.loffset = read_uint64(buf, at);
+			int nchunk = read_int32(buf, at);
+			for (int k = 0; k < nchunk; k++){
+				Chunk c;
+				c.beg = read_uint64(buf, at);
+				c.end = read_uint64(buf, at);
+				b.chunks.push_back(c);
+			}
+			bins[i][bin] = b;
+		}
+		if (!csi){
+			int nintv = read_int32(buf, at);
+			for (int j = 0; j < nintv; j++) linear[i].push_back(read_uint64(buf, at));
+		}
+	}
+	if (names.size() != nref){
+		cerr << "ERROR: index "<< indexfile << " has no sequence names, was it made with tabix?\n";
+		exit(1);
+	}
+	return true;
+}
+
+int TabixIndex::get_tid(string chr){
+	map<string, int>::iterator it = tids.find(chr);
+	if (it == tids.end()) return -1;
+	return it->second;
+}
+
+void TabixIndex::reg2bins(int64_t beg, int64_t end, vector<unsigned int>& toreturn){
+	// all bins overlapping [beg, end), 0-based
+	int s = min_shift + depth*3;
+	if (end >= ((int64_t) 1 << s)) end = (int64_t) 1 << s;
+	if (beg >= end) return;
+	end--;
+	int t = 0;
+	for (int l = 0; l <= depth; l++){
+		for (int64_t b = t + (beg >> s); b <= t + (end >> s); b++) toreturn.push_back(b);
+		s -= 3;
+		t += 1 << (l*3);
+	}
+}
+
+bool TabixIndex::query(int tid, int beg, int end, uint64_t& voffset){
+	if (tid < 0 || tid >= bins.size()) return false;
+	// the index is 0-based; widen by one so files indexed either way are covered
+	int64_t beg0 = beg > 1 ? beg-2 : 0;
+	int64_t end0 = (int64_t) end + 1;
+	map<unsigned int, Bin>& bidx = bins[tid];
+
+	// smallest offset of a record that can overlap beg
+	uint64_t minoff = 0;
+	if (!csi){
+		vector<uint64_t>& ioff = linear[tid];
+		if (ioff.size() > 0){
+			int64_t i = beg0 >> min_shift;
+			if (i >= ioff.size()) i = ioff.size()-1;
+			minoff = ioff[i];
+		}
+	}
+	else{
+		int64_t bin = (((int64_t) 1 << depth*3) - 1)/7 + (beg0 >> min_shift);
+		while (bin > 0 && bidx.find(bin) == bidx.end()) bin = (bin-1) >> 3;
+		map<unsigned int, Bin>::iterator it = bidx.find(bin);
+		if (it != bidx.end()) minoff = it->second.loffset;
+	}
+
+	vector<unsigned int> overlapping;
+	reg2bins(beg0, end0, overlapping);
+	bool found = false;
+	for (vector<unsigned int>::iterator it = overlapping.begin(); it != overlapping.end(); it++){
+		map<unsigned int, Bin>::iterator b = bidx.find(*it);
+		if (b == bidx.end()) continue;
+		for (vector<Chunk>::iterator c = b->second.chunks.begin(); c != b->second.chunks.end(); c++){
+			if (c->end <= minoff) continue;
+			uint64_t st = c->beg < minoff ? minoff : c->beg;
+			if (!found || st < voffset) voffset = st;
+			found = true;
+		}
+	}
+	return found;
+}
+
+TabixReader::TabixReader(){
+	gz = NULL;
+	indexed = false;
+	current = 0;
+	chrcol = 0;
+	poscol = 0;
+}
+
+TabixReader::~TabixReader(){
+	close();
+}
+
+void TabixReader::close(){
+	if (gz != NULL) gzclose(gz);
+	gz = NULL;
+}
+
+bool TabixReader::find_index(){
+	struct stat stFileInfo;
+	string tbi = infile + ".tbi";
+	string csi = infile + ".csi";
+	if (stat(tbi.c_str(), &stFileInfo) == 0) indexed = idx.load(tbi);
+	else if (stat(csi.c_str(), &stFileInfo) == 0) indexed = idx.load(csi);
+	else indexed = false;
+	return indexed;
+}
+
+bool TabixReader::open(string f, vector<string> regionstrs, int c, int p){
+	infile = f;
+	chrcol = c;
+	poscol = p;
+	current = 0;
+	regions.clear();
+	find_index();
+	for (vector<string>::iterator it = regionstrs.begin(); it != regionstrs.end(); it++){
+		// chr, chr:start or chr:start-end
+		Region r;
+		r.beg = 1;
+		r.end = INT_MAX;
+		size_t colon = it->rfind(':');
+		r.chr = it->substr(0, colon);
+		if (colon != string::npos){
+			string range = it->substr(colon+1);
+			size_t dash = range.find('-');
+			r.beg = atoi(range.substr(0, dash).c_str());
+			if (dash != string::npos && dash+1 < range.size()) r.end = atoi(range.substr(dash+1).c_str());
+			if (r.beg < 1 || r.end < r.beg){
+				cerr << "ERROR: cannot parse region "<< *it << "\n";
+				exit(1);
+			}
+		}
+		r.tid = indexed ? idx.get_tid(r.chr) : -1;
+		if (indexed && r.tid < 0){
+			cout << "WARNING: "<< r.chr << " is not in the index of "<< infile << "\n";
+			continue;
+		}
+		regions.push_back(r);
+	}
+	if (indexed) sort_regions();
+	else{
+		cout << "WARNING: no .tbi or .csi index for "<< infile << ", reading the whole file to find the requested regions\n";
+		gz = gzopen(infile.c_str(), "rb");
+		string header;
+		read_line(header);
+	}
+	return true;
+}
+
+bool TabixReader::open_except(string f, string chrtodrop, int c, int p){
+	infile = f;
+	chrcol = c;
+	poscol = p;
+	current = 0;
+	regions.clear();
+	if (!find_index()) return false;
+	for (int i = 0; i < idx.names.size(); i++){
+		if (idx.names[i] == chrtodrop) continue;
+		Region r;
+		r.chr = idx.names[i];
+		r.tid = i;
+		r.beg = 1;
+		r.end = INT_MAX;
+		regions.push_back(r);
+	}
+	return true;
+}
+
+static bool region_lt(const Region& a, const Region& b){
+	if (a.tid != b.tid) return a.tid < b.tid;
+	return a.beg < b.beg;
+}
+
+void TabixReader::sort_regions(){
+	// read regions in file order, merging overlaps so no SNP is read twice
+	sort(regions.begin(), regions.end(), region_lt);
+	vector<Region> merged;
+	for (vector<Region>::iterator it = regions.begin(); it != regions.end(); it++){
+		if (merged.size() > 0 && merged.back().tid == it->tid && it->beg <= merged.back().end){
+			if (it->end > merged.back().end) merged.back().end = it->end;
+		}
+		else merged.push_back(*it);
+	}
+	regions = merged;
+}
+
+bool TabixReader::seek(uint64_t voffset){
+	close();
+	int fd = ::open(infile.c_str(), O_RDONLY);
+	if (fd < 0){
+		cerr << "ERROR: cannot open file " << infile << "\n";
+		exit(1);
+	}
+	// upper 48 bits are the offset of the bgzf block, lower 16 the offset in the block
+	if (lseek(fd, (off_t) (voffset >> 16), SEEK_SET) < 0){
+		cerr << "ERROR: cannot seek in " << infile << "\n";
+		exit(1);
+	}
+	gz = gzdopen(fd, "rb");
+	int within = voffset & 0xffff;
+	char buf[65536];
+	if (within > 0 && gzread(gz, buf, within) != within){
+		cerr << "ERROR: index of "<< infile << " does not match the file\n";
+		exit(1);
+	}
+	return true;
+}
+
+bool TabixReader::read_line(string& line){
+	line.clear();
+	if (gz == NULL) return false;
+	char buf[8192];
+	while (gzgets(gz, buf, sizeof(buf)) != NULL){
+		line += buf;
+		if (line[line.size()-1] == '\n'){
+			line.erase(line.size()-1);
+			return true;
+		}
+	}
+	return !line.empty();
+}
+
+bool TabixReader::get_chrpos(const string& line, string& chr, int& pos){
+	// pull out the two columns without splitting the whole line
+	int col = 0;
+	int found = 0;
+	size_t i = 0;
+	while (i < line.size() && found < 2){
+		while (i < line.size() && isspace(line[i])) i++;
+		size_t st = i;
+		while (i < line.size() && !isspace(line[i])) i++;
+		if (st == i) break;
+		if (col == chrcol) { chr = line.substr(st, i-st); found++; }
+		if (col == poscol) { pos = atoi(line.c_str()+st); found++; }
+		col++;
+	}
+	return found == 2;
+}
+
+bool TabixReader::getline(string& line){
+	while (true){
+		if (indexed && gz == NULL){
+			if (current >= regions.size()) return false;
+			Region& r = regions[current];
+			uint64_t voffset;
+			if (!idx.query(r.tid, r.beg, r.end, voffset)){
+				current++;
+				continue;
+			}
+			seek(voffset);
+		}
+		if (!read_line(line)){
+			close();
+			if (!indexed) return false;
+			current++;
+			continue;
+		}
+		if (line.size() == 0 || line[0] == idx.meta) continue;
+		string chr;
+		int pos;
+		if (!get_chrpos(line, chr, pos)) continue;
+		if (indexed){
+			Region& r = regions[current];
+			// past the end of the region
+			if (chr != r.chr || pos > r.end){
+				close();
+				current++;
+				continue;
+			}
+			if (pos >= r.beg) return true;
+			continue;
+		}
+		for (vector<Region>::iterator it = regions.begin(); it != regions.end(); it++){
+			if (chr == it->chr && pos >= it->beg && pos <= it->end) return true;
+		}
+	}
+}
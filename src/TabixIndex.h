@@ -0,0 +1,69 @@
+/*
+ * TabixIndex.h
+ *
+ *  Reads a tabix (.tbi) or CSI (.csi) index of a bgzipped input file, so that
+ *  only the blocks overlapping the requested regions are decompressed.
+ */
+
+#ifndef TABIX_INDEX_H_
+#define TABIX_INDEX_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <cstdlib>
+#include <stdint.h>
+#include <zlib.h>
+using namespace std;
+
+struct Region{
+	string chr;
+	int tid; // index of the chromosome in the index, -1 if not indexed
+	int beg, end; // 1-based, inclusive
+};
+
+class TabixIndex{
+public:
+	TabixIndex();
+	bool load(string indexfile);
+	vector<string> names;
+	int format, col_seq, col_beg, col_end, meta, skip;
+	int get_tid(string);
+	bool query(int tid, int beg, int end, uint64_t& voffset); // first virtual offset to read for [beg, end]
+	void reg2bins(int64_t beg, int64_t end, vector<unsigned int>& toreturn); // bins overlapping [beg, end), 0-based
+
+private:
+	struct Chunk{ uint64_t beg, end; };
+	struct Bin{ uint64_t loffset; vector<Chunk> chunks; };
+	int min_shift, depth;
+	bool csi;
+	vector<map<unsigned int, Bin> > bins;
+	vector<vector<uint64_t> > linear; // .tbi only
+	map<string, int> tids;
+};
+
+class TabixReader{
+public:
+	TabixReader();
+	~TabixReader();
+	bool open(string infile, vector<string> regions, int chrcol, int poscol);
+	bool open_except(string infile, string chrtodrop, int chrcol, int poscol);
+	bool getline(string&);
+	void close();
+	vector<Region> regions;
+	bool indexed;
+private:
+	string infile;
+	TabixIndex idx;
+	gzFile gz;
+	int current;
+	int chrcol, poscol;
+	bool find_index();
+	void sort_regions();
+	bool seek(uint64_t voffset);
+	bool read_line(string&);
+	bool get_chrpos(const string&, string&, int&);
+};
+
+#endif /* TABIX_INDEX_H_ */
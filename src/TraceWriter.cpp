@@ -0,0 +1,97 @@
+/*
+ * TraceWriter.cpp
+ */
+
+#include "TraceWriter.h"
+#include "Profile.h"
+using namespace std;
+
+static const size_t TRACE_BLOCK = 1 << 16;
+
+TraceWriter::TraceWriter(){
+	out = NULL;
+}
+
+TraceWriter::~TraceWriter(){
+	close();
+}
+
+bool TraceWriter::open(string file){
+	out = fopen(file.c_str(), "w");
+	if (!out) return false;
+	start = wall_seconds();
+	buf.reserve(TRACE_BLOCK);
+#ifdef _OPENMP
+	stopping = false;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	pthread_cond_init(&written, NULL);
+	if (pthread_create(&thread, NULL, run, this) != 0){
+		cerr << "ERROR: cannot start the thread writing "<< file << "\n";
+		exit(1);
+	}
+#endif
+	return true;
+}
+
+double TraceWriter::elapsed(){
+	return wall_seconds() - start;
+}
+
+void TraceWriter::write(const string& line){
+	if (!out) return;
+	buf += line;
+	buf += '\n';
+	if (buf.size() < TRACE_BLOCK) return;
+#ifdef _OPENMP
+	// hand the block over once the previous one is written
+	pthread_mutex_lock(&lock);
+	while (!pending.empty()) pthread_cond_wait(&written, &lock);
+	pending.swap(buf);
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+#else
+	fwrite(buf.data(), 1, buf.size(), out);
+#endif
+	buf.clear();
+}
+
+#ifdef _OPENMP
+void* TraceWriter::run(void* arg){
+	TraceWriter* t = (TraceWriter*) arg;
+	pthread_mutex_lock(&t->lock);
+	while (true){
+		while (t->pending.empty() && !t->stopping) pthread_cond_wait(&t->wake, &t->lock);
+		if (t->pending.empty()) break;
+		// the block is not touched by write() until it is cleared
+		pthread_mutex_unlock(&t->lock);
+		fwrite(t->pending.data(), 1, t->pending.size(), t->out);
+		pthread_mutex_lock(&t->lock);
+		t->pending.clear();
+		pthread_cond_signal(&t->written);
+	}
+	pthread_mutex_unlock(&t->lock);
+	return NULL;
+}
+#endif
+
+void TraceWriter::close(){
+	if (!out) return;
+#ifdef _OPENMP
+	pthread_mutex_lock(&lock);
+	while (!pending.empty()) pthread_cond_wait(&written, &lock);
+	pending.swap(buf);
+	stopping = true;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	pthread_mutex_destroy(&lock);
+	pthread_cond_destroy(&wake);
+	pthread_cond_destroy(&written);
+#else
+	fwrite(buf.data(), 1, buf.size(), out);
+#endif
+	buf.clear();
+	fclose(out);
+	out = NULL;
+}
@@ -0,0 +1,45 @@
+/*
+ * TraceWriter.h
+ *
+ *  Writes the lines of -trace to a file in blocks, off the thread of the
+ *  optimizer where it can.
+ */
+
+#ifndef TRACEWRITER_H_
+#define TRACEWRITER_H_
+
+#include "fgwas_params.h"
+#include <cstdio>
+#ifdef _OPENMP
+#include <pthread.h>
+#endif
+using namespace std;
+
+// -trace: lines are added to a buffer, which is written to the file in blocks. With OpenMP (which
+// links the thread library) a background thread writes a full block while the next one fills,
+// otherwise the block is written when it is full.
+class TraceWriter{
+public:
+	TraceWriter();
+	~TraceWriter();
+	bool open(string file);
+	bool is_open() { return out != NULL; }
+	void write(const string& line);
+	void close(); // writes what is left
+	double elapsed(); // seconds since open()
+private:
+	FILE* out;
+	string buf, pending; // filling, being written
+	double start; // wall_seconds() at open()
+#ifdef _OPENMP
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake, written;
+	bool stopping;
+	static void* run(void*);
+#endif
+	TraceWriter(const TraceWriter&);
+	TraceWriter& operator=(const TraceWriter&);
+};
+
+#endif /* TRACEWRITER_H_ */
@@ -18,18 +18,26 @@ extern double FIXED_B1_VAL;
 
 string get_ci_string(pair<pair<int, int>, pair<double, double> >, double estimate);
 
+// written where the results of a step stopped by -timelimit are
+static const char* TIMELIMIT_NOTE = "converged: no (stopped at -timelimit, continue with -resume)";
+
 void printopts(){
         cout << "\nqfgwas v. 0.3.6\n";
         cout << "by Joe Pickrell (jkpickrell@nygenome.org)\n\n";
         cout << "-i [file name] input file w/ Z-scores\n";
         cout << "-o [string] stem for names of output files\n";
+        cout << "-region [string] only read SNPs in this region (chr:start-end). Separate multiple regions with commas\n";
+        cout << "-chroms [string] only read SNPs on these chromosomes. Separate multiple chromosomes with commas\n";
         cout << "-w [string] which annotation(s) to use. Separate multiple annotations with plus signs\n";
+        cout << "-wbed [string:string] the name of the annotation(s) and the .bed file(s) containing the annotated regions\n";
         cout << "-q [string] which quantitative annotation(s) to use. Separate multiple annotations with plus signs\n";
         cout << "-b1val [float] use a 2-parameter quantitative annotation model with this fixed value of b1\n";
+        cout << "-qbins [integer] quantize quantitative annotations into this many bins (up to 65535) for faster evaluation\n";
         cout << "-dists [string:string] the name of the distance annotation(s) and the file(s) containing the distance model(s)\n";
         cout << "-k [integer] block size in number of SNPs (5000)\n";
         cout << "-bed [string] read block positions from a .bed file\n";
         cout << "-v [float] variance of prior on normalized effect size. To average priors, separate with commas (0.01,0.1,0.5)\n";
+        cout << "-vsweep [string] after the fit, refit with each of these prior variance grids (commas within a grid, plus signs between grids)\n";
         cout << "-p [float] penalty on sum of squared lambdas, only relevant for -print (0.2)\n";
         //cout << "-mse input is in mean/standard error format (default is Z-score, sample size)\n";
         cout << "-print print the per-SNP output\n";
@@ -39,8 +47,25 @@ void printopts(){
         cout << "-cc this is a case-control study, which implies a different input file format\n";
         cout << "-fine this is a fine mapping study, which implies a different input file format\n";
         cout << "-onlyp only do optimization under penalized likelihood\n";
-        cout << "-cond [string] estimate the effect size of an annotation conditional on the others in the model\n";
+        cout << "-cond [string] estimate the effect size of an annotation conditional on the others in the model (annotations separated by +, or all)\n";
         cout << "-noci do not estimate confidence intervals (for quicker run)\n";
+        cout << "-optim [string] optimizer: nm (built-in Nelder-Mead), gsl, em or squarem (EM with SQUAREM acceleration; no -q) (gsl)\n";
+        cout << "-tol [float] stop optimizing when the simplex size (em: the step) is below this, or em improves ln(lk) by less than 1% of it (0.001)\n";
+        cout << "-maxiter [integer] maximum number of optimizer iterations (5000)\n";
+        cout << "-plateau [integer float] stop if ln(lk) improves less than the float over this many iterations (200 0.2)\n";
+        cout << "-stuck [integer] stop if the optimizer is stuck for this many iterations (2*number of parameters+10)\n";
+        cout << "-starts [integer] optimize from this many starting points in parallel and keep the best (1)\n";
+        cout << "-approx [float] while optimizing, replace segments whose ln(lk) can be bounded to within this by a closed form (off)\n";
+        cout << "-prune [float float] while optimizing, group SNPs far below their segment's largest BF so that ln(lk) of each segment is within the first float, while lambda*b1/4 of the quantitative annotations is at most the second (off)\n";
+        cout << "-init [file] start the optimizer from the parameters in a .params or .ridgeparams file, matched by name (others start as without it)\n";
+        cout << "-autoinit start the optimizer from enrichments estimated from the Bayes factors\n";
+        cout << "-checkpoint [float] save the optimizer state and finished steps to [stem].ckpt at most this many seconds apart (off)\n";
+        cout << "-resume continue from [stem].ckpt, skipping the steps finished there (needs the same model, options and input)\n";
+        cout << "-timelimit [float] stop after this many seconds, writing the best parameters so far (flagged as not converged) and [stem].ckpt (off)\n";
+        cout << "-loglevel [integer] 0: no line per optimizer iteration, 1: a line per iteration, 2: also the steps of the confidence interval searches (1)\n";
+        cout << "-trace [string] write a tab-separated line per optimizer iteration (step, iteration, ln(lk) evaluations, seconds, ln(lk), parameters) to this file\n";
+        cout << "-profile write the wall and CPU time of each step, and counts of the work in the likelihood, to [stem].profile.json\n";
+        cout << "-chrometrace [string] write what each thread did when (reading, ln(lk) batches, CIs, x-validation folds, output) to this file, for chrome://tracing or Perfetto\n";
 
         cout << "\n";
 }
@@ -60,6 +85,18 @@ int main(int argc, char *argv[]){
         exit(1);
     }
     if (cmdline.HasSwitch("-o")) p.outstem = cmdline.GetArgument("-o", 0);
+    if (cmdline.HasSwitch("-region")){
+    	vector<string> strs;
+    	string s = cmdline.GetArgument("-region", 0);
+    	boost::split(strs, s ,boost::is_any_of(","));
+    	for (int i  = 0; i < strs.size(); i++) p.regions.push_back(strs[i]);
+    }
+    if (cmdline.HasSwitch("-chroms")){
+    	vector<string> strs;
+    	string s = cmdline.GetArgument("-chroms", 0);
+    	boost::split(strs, s ,boost::is_any_of(","));
+    	for (int i  = 0; i < strs.size(); i++) p.regions.push_back(strs[i]);
+    }
     if (cmdline.HasSwitch("-k")) p.K = atoi(cmdline.GetArgument("-k", 0).c_str());
     if (cmdline.HasSwitch("-bed")) {
     	p.bedseg = true;
@@ -77,15 +114,53 @@ int main(int argc, char *argv[]){
     		p.V.push_back( atof(strs[i].c_str()) );
     	}
     }
+    if (cmdline.HasSwitch("-vsweep")) {
+    	vector<string> grids;
+    	string s = cmdline.GetArgument("-vsweep", 0);
+    	boost::split(grids, s ,boost::is_any_of("+"));
+    	for (int i  = 0; i < grids.size(); i++) {
+    		vector<string> strs;
+    		boost::split(strs, grids[i] ,boost::is_any_of(","));
+    		vector<double> grid;
+    		for (int j = 0; j < strs.size(); j++) grid.push_back( atof(strs[j].c_str()) );
+    		p.Vsweep.push_back(grid);
+    	}
+    }
     if (cmdline.HasSwitch("-xv")) { p.xv = true; }
     if (cmdline.HasSwitch("-p")) p.ridge_penalty = atof(cmdline.GetArgument("-p", 0).c_str());
     if (cmdline.HasSwitch("-mse")) p.zformat = false;
     if (cmdline.HasSwitch("-print")) p.print = true;
     if (cmdline.HasSwitch("-onlyp")) p.onlyp = true;
     if (cmdline.HasSwitch("-noci")) p.noci = true;
+    if (cmdline.HasSwitch("-optim")) {
+    	p.optimizer = cmdline.GetArgument("-optim", 0);
+    	if (p.optimizer != "nm" && p.optimizer != "gsl" && p.optimizer != "em" && p.optimizer != "squarem"){
+    		cerr << "ERROR: unknown optimizer "<< p.optimizer << "\n";
+    		exit(1);
+    	}
+    }
+    if (cmdline.HasSwitch("-tol")) p.optim_tol = atof(cmdline.GetArgument("-tol", 0).c_str());
+    if (cmdline.HasSwitch("-maxiter")) p.optim_maxiter = atoi(cmdline.GetArgument("-maxiter", 0).c_str());
+    if (cmdline.HasSwitch("-plateau")) {
+    	p.plateau_iter = atoi(cmdline.GetArgument("-plateau", 0).c_str());
+    	p.plateau_llk = atof(cmdline.GetArgument("-plateau", 1).c_str());
+    }
+    if (cmdline.HasSwitch("-stuck")) p.stuck_iter = atoi(cmdline.GetArgument("-stuck", 0).c_str());
+    if (cmdline.HasSwitch("-starts")) {
+    	p.nstarts = atoi(cmdline.GetArgument("-starts", 0).c_str());
+    	if (p.nstarts < 1) {
+    		cerr << "ERROR: -starts needs at least 1 starting point\n";
+    		exit(1);
+    	}
+    	if (p.nstarts > 1 && p.optimizer != "nm") {
+    		cerr << "ERROR: -starts is only available with -optim nm\n";
+    		exit(1);
+    	}
+    }
     if (cmdline.HasSwitch("-cond")){
     	p.cond = true;
-    	p.testcond_annot = cmdline.GetArgument("-cond", 0);
+    	string s = cmdline.GetArgument("-cond", 0);
+    	boost::split(p.testcond_annot, s, boost::is_any_of("+"));
     }
     if (cmdline.HasSwitch("-w")){
     	vector<string> strs;
@@ -95,6 +170,21 @@ int main(int argc, char *argv[]){
     		p.wannot.push_back( strs[i] );
     	}
     }
+    if (cmdline.HasSwitch("-wbed")){
+     	vector<string> strs;
+     	string s = cmdline.GetArgument("-wbed", 0);
+     	boost::split(strs, s ,boost::is_any_of("+"));
+     	for (int i  = 0; i < strs.size(); i++) {
+     		vector<string> strs2;
+     		boost::split(strs2, strs[i], boost::is_any_of(":"));
+     		if (strs2.size() != 2){
+     			cerr << "ERROR: -wbed takes name:file.bed, found "<< strs[i] << "\n";
+     			exit(1);
+     		}
+     		p.bedannot.push_back( strs2[0] );
+     		p.bedannotfiles.push_back(strs2[1]);
+     	}
+    }
     if (cmdline.HasSwitch("-q")){
     	vector<string> strs;
     	string s = cmdline.GetArgument("-q", 0);
@@ -104,6 +194,13 @@ int main(int argc, char *argv[]){
     	}
     }
     if (cmdline.HasSwitch("-b1val")) p.fixedB1val = atof(cmdline.GetArgument("-b1val", 0).c_str());
+    if (cmdline.HasSwitch("-qbins")) {
+    	p.qbins = atoi(cmdline.GetArgument("-qbins", 0).c_str());
+    	if (p.qbins < 1 || p.qbins > 65535){
+    		cerr << "ERROR: -qbins must be between 1 and 65535\n";
+    		exit(1);
+    	}
+    }
     FIXED_B1_VAL = p.fixedB1val;
     
     if (cmdline.HasSwitch("-dists")){
@@ -134,10 +231,66 @@ int main(int argc, char *argv[]){
     	p.hiquant = atof(cmdline.GetArgument("-dens", 2).c_str());
     }
 
+	if (cmdline.HasSwitch("-approx")) {
+		p.approx_eps = atof(cmdline.GetArgument("-approx", 0).c_str());
+		if (p.approx_eps <= 0 || p.optimizer == "gsl") {
+			cerr << "ERROR: -approx needs a positive epsilon, and -optim nm, em or squarem\n";
+			exit(1);
+		}
+	}
+	if (cmdline.HasSwitch("-prune")) {
+		p.prune_eps = atof(cmdline.GetArgument("-prune", 0).c_str());
+		p.prune_slope = atof(cmdline.GetArgument("-prune", 1).c_str());
+		if (p.prune_eps <= 0 || p.prune_slope <= 0 || p.optimizer == "gsl") {
+			cerr << "ERROR: -prune needs a positive epsilon and slope, and -optim nm, em or squarem\n";
+			exit(1);
+		}
+		if (p.qbins > 0) {
+			cerr << "ERROR: -prune and -qbins can not be used together\n";
+			exit(1);
+		}
+	}
+	if (cmdline.HasSwitch("-init")) p.initfile = cmdline.GetArgument("-init", 0);
+	if (cmdline.HasSwitch("-autoinit")) p.autoinit = true;
+	if (p.autoinit && p.initfile.size() > 0) {
+		cerr << "ERROR: -autoinit and -init can not be used together\n";
+		exit(1);
+	}
+	if (cmdline.HasSwitch("-checkpoint")) {
+		p.checkpoint_sec = atof(cmdline.GetArgument("-checkpoint", 0).c_str());
+		if (p.checkpoint_sec <= 0) {
+			cerr << "ERROR: -checkpoint needs a positive number of seconds\n";
+			exit(1);
+		}
+	}
+	if (cmdline.HasSwitch("-resume")) p.resume = true;
+	if (cmdline.HasSwitch("-timelimit")) {
+		p.timelimit = atof(cmdline.GetArgument("-timelimit", 0).c_str());
+		if (p.timelimit <= 0) {
+			cerr << "ERROR: -timelimit needs a positive number of seconds\n";
+			exit(1);
+		}
+	}
+	if (cmdline.HasSwitch("-loglevel")) {
+		p.loglevel = atoi(cmdline.GetArgument("-loglevel", 0).c_str());
+		if (p.loglevel < 0 || p.loglevel > 2) {
+			cerr << "ERROR: -loglevel must be 0, 1 or 2\n";
+			exit(1);
+		}
+	}
+	if (cmdline.HasSwitch("-trace")) p.tracefile = cmdline.GetArgument("-trace", 0);
+	if (cmdline.HasSwitch("-profile")) p.profile = true;
+	if (cmdline.HasSwitch("-chrometrace")) p.chrometrace = cmdline.GetArgument("-chrometrace", 0);
+	if ((p.optimizer == "em" || p.optimizer == "squarem") && p.quantannot.size() > 0){
+		cerr << "ERROR: -optim "<< p.optimizer << " does not handle quantitative annotations (-q)\n";
+		exit(1);
+	}
+
 	SNPs s(&p);
 
 	//if doing unpenalized optimization
 	if (!p.onlyp){
+		s.prof.start("fit");
 		s.GSL_optim();
 
 		// conditional analysis
@@ -145,9 +298,13 @@ int main(int argc, char *argv[]){
 			string llkoutfile = p.outstem+".llk";
 			ofstream lkout(llkoutfile.c_str());
 			lkout << "ln(lk) [w/o cond]: "<<  s.llk() << "\n";
-			s.optimize_condlambda();
-			double cl = s.condlambda;
-			lkout << "ln(lk) [w cond]: "<< s.llk() << "\n";
+			if (s.timed_out) lkout << TIMELIMIT_NOTE << "\n";
+			s.prof.start("cond");
+			vector<CondFit> fits = s.optimize_condlambdas(!p.noci);
+			for (int i = 0; i < fits.size(); i++){
+				if (fits.size() == 1) lkout << "ln(lk) [w cond]: "<< fits[i].llk << "\n";
+				else lkout << "ln(lk) [w cond "<< s.condannotnames[i] << "]: "<< fits[i].llk << "\n";
+			}
 
 			string outparam = p.outstem+".params";
 			ofstream out(outparam.c_str());
@@ -158,12 +315,10 @@ int main(int argc, char *argv[]){
 			for (int i = 0; i < s.quantparams.size(); i++){
 				out << s.quantannotnames[i] << " " << s.quantparams[i].lambda << " " << s.quantparams[i].b0 << " " << s.quantparams[i].b1 << "\n";
 			}
-			out << p.testcond_annot << " ";
-			if (!p.noci) {
-				pair<pair<int, int>, pair<double, double> > cond_cis = s.get_cis_condlambda();
-				out << get_ci_string(cond_cis, s.condlambda) << endl;
-			} else {
-				out << s.condlambda << endl;
+			for (int i = 0; i < fits.size(); i++){
+				out << s.condannotnames[i] << " ";
+				if (!p.noci) out << get_ci_string(fits[i].ci, fits[i].lambda) << endl;
+				else out << fits[i].lambda << endl;
 			}
 		}
 
@@ -174,11 +329,20 @@ int main(int argc, char *argv[]){
 			int np = s.lambdas.size() + s.seglambdas.size() + s.quantModelParamNum*s.quantparams.size();
 
 			lkout << "ln(lk): "<<  s.llk() << "\n";
+			if (p.qbins > 0){
+				pair<double, double> err = s.qbins_error();
+				lkout << "ln(lk) without -qbins: "<< s.llk() + err.second << "\n";
+				lkout << "max abs difference in ln(SNP prior) from -qbins: "<< err.first << "\n";
+			}
 			lkout << "nparam: "<< np << "\n";
 			lkout << "AIC: "<< 2.0* (double) np - 2* s.llk() << "\n";
 
+			// no CIs around parameters that have not converged
+			bool ci = !p.noci && !s.timed_out;
 			vector<pair<pair<int, int>, pair<double, double> > > cis;
-			if (!p.noci) cis = s.get_cis();
+			s.prof.start("ci");
+			if (ci) cis = s.get_cis();
+			if (s.timed_out) lkout << TIMELIMIT_NOTE << "\n";
 
 			string outparam = p.outstem+".params";
 			ofstream out(outparam.c_str());
@@ -188,14 +352,14 @@ int main(int argc, char *argv[]){
 			//not fine-mapping (there are segment-level annotations)
 			if (!p.finemap){
 				out << "pi_region ";
-				if (!p.noci)
+				if (ci)
 					out << get_ci_string(cis[ciIndex++], s.segpi) << endl;
 				else
 					out << s.segpi << endl;
 				
 				for (int i = 0; i < s.seglambdas.size(); i++){
 					out << s.segannotnames[i] << "_ln ";
-					if (!p.noci)
+					if (ci)
 						out << get_ci_string(cis[ciIndex++], s.seglambdas[i]) << endl;
 					else
 						out << s.seglambdas[i] << endl;
@@ -205,7 +369,7 @@ int main(int argc, char *argv[]){
 			//print annotations
 			for (int i = 0; i < s.lambdas.size(); i++){
 				out << s.annotnames[i] << "_ln ";
-				if (!p.noci)
+				if (ci)
 					out << get_ci_string(cis[ciIndex++], s.lambdas[i]) << endl;
 				else
 					out << s.lambdas[i] << endl;
@@ -213,7 +377,7 @@ int main(int argc, char *argv[]){
 			out << "QuantParam CI_lo estimate CI_hi b0 b1\n";
 			for (int i = 0; i < s.quantparams.size(); i++){
 				out << s.quantannotnames[i] << "_ln ";
-				if (!p.noci)
+				if (ci)
 					out << get_ci_string(cis[ciIndex++], s.quantparams[i].lambda);
 				else
 					out << s.quantparams[i].lambda;
@@ -223,7 +387,8 @@ int main(int argc, char *argv[]){
 	}
 
 	// penalized likelihood
-	if ( (p.print || p.xv || p.onlyp) && !p.cond) {
+	if ( (p.print || p.xv || p.onlyp) && !p.cond && !s.timed_out) {
+		s.prof.start("ridge");
 		s.GSL_optim_ridge();
 		string outridge = p.outstem+".ridgeparams";
 		ofstream outr(outridge.c_str());
@@ -232,13 +397,24 @@ int main(int argc, char *argv[]){
 		for (int i = 0; i < s.lambdas.size(); i++) outr << s.annotnames[i] << " " << s.lambdas[i] << "\n";
 		outr << "QuantParam lambda b0 b1\n";
 		for (int i = 0; i < s.quantparams.size(); i++) outr << s.quantannotnames[i] << " " << s.quantparams[i].lambda << " " << s.quantparams[i].b0 << " " << s.quantparams[i].b1 << endl;
+		if (s.timed_out) outr << TIMELIMIT_NOTE << "\n";
 		
 		// print the PPAs
-		if (p.print) s.print(p.outstem+".bfs.gz", p.outstem+".segbfs.gz");
+		if (p.print && !s.timed_out) {
+			s.prof.start("print");
+			s.print(p.outstem+".bfs.gz", p.outstem+".segbfs.gz");
+		}
 		
-		if (p.xv) {
+		if (p.xv && !s.timed_out) {
 			ostringstream xvOutStr;
+			s.prof.start("xv");
 			vector<double> xvlks = s.cross10(true, xvOutStr, p.outstem+".xv.bfs.gz", p.outstem+".xv.segbfs.gz");
+			if (s.timed_out) {
+				outr << "\nX-validation: "<< xvlks.size() << " of 10 folds done, " << TIMELIMIT_NOTE << "\n";
+				s.prof.write(p.outstem+".profile.json");
+				s.spans.write(p.chrometrace);
+				return 0;
+			}
 			
 			double meanxvlk = std::accumulate(xvlks.begin(), xvlks.end(), 0.0) / xvlks.size();
 			outr << "\nX-validation ln(lk) average: " << meanxvlk << endl;
@@ -256,7 +432,43 @@ int main(int argc, char *argv[]){
 		}
 	}
 
+	// V-sensitivity: recompute the Bayes factors from the Z-scores (read again from the input) and refit
+	if (p.Vsweep.size() > 0 && !s.timed_out) {
+		s.prof.start("vsweep");
+		string outsweep = p.outstem+".vsweep";
+		ofstream outs(outsweep.c_str());
+		outs << "V ln(lk)";
+		if (!p.finemap){
+			outs << " pi_region";
+			for (int i = 0; i < s.segannotnames.size(); i++) outs << " "<< s.segannotnames[i] << "_ln";
+		}
+		for (int i = 0; i < s.annotnames.size(); i++) outs << " "<< s.annotnames[i] << "_ln";
+		for (int i = 0; i < s.quantannotnames.size(); i++) outs << " "<< s.quantannotnames[i] << "_ln";
+		outs << "\n";
+		for (int i = 0; i < p.Vsweep.size(); i++){
+			s.set_BFs(p.Vsweep[i]);
+			s.free_zv();
+			ostringstream phase;
+			phase << "vsweep" << i+1;
+			s.GSL_optim(phase.str());
+			if (s.timed_out) {
+				outs << TIMELIMIT_NOTE << "\n";
+				break;
+			}
+			for (int j = 0; j < p.Vsweep[i].size(); j++) outs << (j > 0 ? "," : "") << p.Vsweep[i][j];
+			outs << " "<< s.llk();
+			if (!p.finemap){
+				outs << " "<< s.segpi;
+				for (int j = 0; j < s.seglambdas.size(); j++) outs << " "<< s.seglambdas[j];
+			}
+			for (int j = 0; j < s.lambdas.size(); j++) outs << " "<< s.lambdas[j];
+			for (int j = 0; j < s.quantparams.size(); j++) outs << " "<< s.quantparams[j].lambda;
+			outs << "\n";
+		}
+	}
 
+	s.prof.write(p.outstem+".profile.json");
+	s.spans.write(p.chrometrace);
 	return 0;
 }
 
@@ -265,9 +477,11 @@ string get_ci_string(pair<pair<int, int>, pair<double, double> > ci, double esti
 	ostringstream ostr;
 	if (ci.first.first == 0)  ostr << ci.second.first << " " << estimate << " ";
 	else if (ci.first.first == 2) ostr << "<" << ci.second.first << " " << estimate << " ";
+	else if (ci.first.first == 3) ostr << "NA " << estimate << " ";
 	else ostr << "fail " << estimate << " ";
 	if (ci.first.second == 0) ostr << ci.second.second;
 	else if (ci.first.second == 2) ostr << ">" << ci.second.second;
+	else if (ci.first.second == 3) ostr << "NA";
 	else ostr << "fail";
 	return ostr.str();
 }
@@ -11,24 +11,48 @@ using namespace std;
 Fgwas_params::Fgwas_params(){
 	K = 5000;
 	V.push_back(0.01); V.push_back(0.1); V.push_back(0.5);
+	Vsweep.clear();
 	print = false;
 	zformat = true;
 	wannot.clear();
 	dannot.clear();
 	distmodels.clear();
+	bedannot.clear();
+	bedannotfiles.clear();
 	quantannot.clear();
 	fixedB1val = 0.0;
+	qbins = 0;
 	segannot.clear();
 	outstem = "fgwas";
 	dropchr = false;
+	regions.clear();
 	cc = false;
 	noci = false;
+	optimizer = "gsl";
+	optim_tol = 0.001;
+	optim_maxiter = 5000;
+	plateau_iter = 200;
+	plateau_llk = 0.2;
+	stuck_iter = 0;
+	nstarts = 1;
+	approx_eps = 0;
+	prune_eps = 0;
+	prune_slope = 0;
+	initfile = "";
+	autoinit = false;
+	checkpoint_sec = 0;
+	resume = false;
+	timelimit = 0;
+	start_time = time(NULL);
+	loglevel = 1;
+	tracefile = "";
+	profile = false;
+	chrometrace = "";
 	finemap = false;
 	ridge_penalty = 0.0;
 	xv = false;
 	onlyp = false;
 	cond = false;
-	testcond_annot = "";
 	pairwise = false;
 	segment_bedfile = "";
 	bedseg = false;
@@ -39,12 +63,38 @@ void Fgwas_params::print_stdout(){
 	cout << ":::Parameter settings::::\n";
 	cout << ":: Input file: "<< infile << "\n";
 	cout << ":: Output stem: "<< outstem << "\n";
+	if (regions.size() > 0){
+		cout << ":: Regions:";
+		for (int i = 0; i < regions.size(); i++) cout << " "<< regions[i];
+		cout << "\n";
+	}
 	if (!bedseg) cout << ":: K: " << K << "\n";
 	else cout << ":: Segment bedfile: "<< segment_bedfile << "\n";
 	cout << ":: V:";
 	for (int i = 0; i < V.size(); i ++)cout <<" "<< V[i];
 	cout << "\n";
+	if (Vsweep.size() > 0){
+		cout << ":: V sweep:";
+		for (int i = 0; i < Vsweep.size(); i++){
+			cout << " ";
+			for (int j = 0; j < Vsweep[i].size(); j++) cout << (j > 0 ? "," : "") << Vsweep[i][j];
+		}
+		cout << "\n";
+	}
 	cout << ":: Ridge penalty: "<< ridge_penalty << "\n";
+	cout << ":: Optimizer: "<< optimizer << " (tolerance "<< optim_tol << ", max iterations "<< optim_maxiter << ", plateau "<< plateau_llk << " over "<< plateau_iter << " iterations)\n";
+	if (nstarts > 1) cout << ":: Starting points: "<< nstarts << "\n";
+	if (approx_eps > 0) cout << ":: Approximate low-signal segments to within: "<< approx_eps << "\n";
+	if (prune_eps > 0) cout << ":: Group low-BF SNPs to within: "<< prune_eps << " (lambda*b1/4 up to "<< prune_slope << ")\n";
+	if (initfile.size() > 0) cout << ":: Initial values from: "<< initfile << "\n";
+	if (autoinit) cout << ":: Initial values from the data\n";
+	if (checkpoint_sec > 0) cout << ":: Checkpoint every: "<< checkpoint_sec << " s\n";
+	if (timelimit > 0) cout << ":: Time limit: "<< timelimit << " s\n";
+	if (resume) cout << ":: Resume from: "<< outstem << ".ckpt\n";
+	if (loglevel != 1) cout << ":: Log level: "<< loglevel << "\n";
+	if (tracefile.size() > 0) cout << ":: Optimizer trace: "<< tracefile << "\n";
+	if (profile) cout << ":: Profile: "<< outstem << ".profile.json\n";
+	if (chrometrace.size() > 0) cout << ":: Thread timeline: "<< chrometrace << "\n";
 	cout << ":: Case-control?: ";
 	if (cc) cout << "yes\n";
 	else cout << "no\n";
@@ -76,11 +126,17 @@ void Fgwas_params::print_stdout(){
 	} else {
 		cout << ":: 3-param quantitative model\n";
 	}
+	if (qbins > 0) cout << ":: Quantitative annotation bins: " << qbins << "\n";
+	cout << ":: SNP .bed annotations:";
+	for (int i = 0; i < bedannot.size(); i++) cout << " " << bedannot[i]<< ":" << bedannotfiles[i];
+	cout << "\n";
 	cout << ":: Distance models:";
 	for (int i = 0; i < dannot.size(); i++)	cout << " " << dannot[i]<< ":" << distmodels[i];  cout << "\n";
 	cout << ":: Segment annotation (low quantile, high quantile):";
 	for (vector<string>::iterator it = segannot.begin(); it != segannot.end(); it++) cout << " "<< *it<<  " ("<< loquant << " "<< hiquant << ")"; cout << "\n";
-	cout << ":: Conditional analysis of: " << testcond_annot << "\n";
+	cout << ":: Conditional analysis of:";
+	for (int i = 0; i < testcond_annot.size(); i++) cout << " " << testcond_annot[i];
+	cout << "\n";
 	cout << ":::::::::::::::::::::::::\n";
 	cout <<"\n\n";
 }
@@ -18,6 +18,7 @@
 #include <map>
 #include <set>
 #include <sys/stat.h>
+#include <ctime>
 #include "gzstream.h"
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_multiroots.h>
@@ -32,26 +33,53 @@ public:
 	Fgwas_params();
 	int K; //block size
 	vector<double> V; //prior variance
+	vector<vector<double> > Vsweep; //other prior variance grids to refit with
 	bool print, zformat;
 	string infile, outstem;
 	bool cc;
 	bool noci; // if true, do not estimate confidence intervals
+	//optimization
+	string optimizer; // "nm" (built-in Nelder-Mead), "gsl", "em" or "squarem"
+	double optim_tol; // converged when the simplex size is below this
+	int optim_maxiter;
+	int plateau_iter; // stop if ln(lk) improves less than plateau_llk over plateau_iter iterations
+	double plateau_llk;
+	int stuck_iter; // stop if stuck at the same point this many iterations (0: 2*nparam+10)
+	int nstarts; // number of starting points, optimized together
+	double approx_eps; // if > 0, bound on the ln(lk) error of each segment replaced by a closed form while optimizing
+	double prune_eps, prune_slope; // -prune: bound on the ln(lk) error of each segment, while lambda*b1/4 <= prune_slope
+	string initfile; // starting values from the .params or .ridgeparams of an earlier fit
+	bool autoinit; // starting values estimated from the Bayes factors
+	//checkpoints (in outstem.ckpt)
+	double checkpoint_sec; // if > 0, save the optimizer state at most this often
+	bool resume; // continue from the checkpoint of an earlier run
+	double timelimit; // if > 0, stop after this many seconds with the best parameters so far
+	time_t start_time;
+	//logging
+	int loglevel; // 0: no iteration lines, 1: iteration lines, 2: also the steps of the line searches
+	string tracefile; // if set, one line per optimizer iteration, tab-separated
+	bool profile; // time of each step and work in the likelihood, in outstem.profile.json
+	string chrometrace; // if set, spans of work on each thread, in Chrome trace-event format
 	//annotation lists
 	vector<string> wannot, dannot, distmodels, segannot;
+	vector<string> bedannot, bedannotfiles; // binary annotations read from .bed files
 	vector<string> quantannot;
 	double fixedB1val;
+	int qbins; // if > 0, quantize quantitative annotations into this many bins
 	double loquant, hiquant;
 
 	//drop chromosomes
 	bool dropchr;
 	string chrtodrop;
+	//only load these regions (chr or chr:start-end)
+	vector<string> regions;
 	void print_stdout();
 	bool finemap;
 	double ridge_penalty;
 	bool xv;
 	bool onlyp;
 	bool cond;
-	string testcond_annot;
+	vector<string> testcond_annot; // or "all"
 	bool pairwise;
 	bool bedseg;
 	string segment_bedfile;
@@ -62,6 +62,7 @@ public:
         // ASSERT: both input & output capabilities will not be used together
     }
     int is_open() { return opened; }
+    long compressed_offset() { return opened ? (long) gzoffset(file) : -1; } // bytes of the file read so far
     gzstreambuf* open( const char* name, int open_mode);
     gzstreambuf* close();
     ~gzstreambuf() { close(); }
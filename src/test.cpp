@@ -3,77 +3,1012 @@
  *
  *  Created on: Jan 14, 2013
  *      Author: pickrell
+ *
+ *  Checks of the fast paths against direct computations on small generated
+ *  inputs. Run from a writable directory (it writes fgwas_test.* files there);
+ *  prints the failed checks and exits with their number.
  */
 
-//#include "SNPs.h"
-//#include "fgwas_params.h"
-#include <iostream>
-#include <vector>
-#include <cmath>
+#include "SNPs.h"
+#include "fgwas_params.h"
+#include "gzstream.h"
+#include <cstdio>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
 using namespace std;
 
-int main(){
-	vector<double> tmp;
-	tmp.push_back(1.23); tmp.push_back(5.45);
-	cout << tmp.size() << " "<< log(tmp.size()) << "\n";
-	/*
+static int nfail = 0;
+
+static void check(bool ok, const string& what){
+	if (ok) return;
+	cerr << "FAIL: "<< what << "\n";
+	nfail++;
+}
+
+static bool near(double a, double b, double tol){
+	return fabs(a-b) <= tol*max(1.0, fabs(b));
+}
+
+// one generated SNP, as written to the input
+struct TestSNP{
+	string chr;
+	int pos;
+	double f, z, q1;
+	bool q1na;
+	int ann1, ann2, tssd;
+};
+
+static double lcg_unif(unsigned long& state){
+	state = state*6364136223846793005UL + 1442695040888963407UL;
+	return ((state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static vector<TestSNP> make_snps(int nperchr, unsigned long seed){
+	//
+	// nperchr SNPs on each of chr1 and chr2. ann1 SNPs carry most of the signal; the first
+	// 300 SNPs of chr2 have no annotations, so their segments do not depend on the lambdas.
+	//
+	vector<TestSNP> snps;
+	unsigned long state = seed;
+	const char* chrs[] = {"chr1", "chr2"};
+	for (int c = 0; c < 2; c++){
+		int pos = 1000;
+		for (int i = 0; i < nperchr; i++){
+			TestSNP t;
+			t.chr = chrs[c];
+			pos += 50 + (int) (450*lcg_unif(state));
+			t.pos = pos;
+			t.f = 0.05 + 0.45*lcg_unif(state);
+			bool plain = c == 1 && i < 300;
+			t.ann1 = !plain && lcg_unif(state) < 0.2;
+			t.ann2 = !plain && lcg_unif(state) < 0.5;
+			double u1 = lcg_unif(state), u2 = lcg_unif(state);
+			t.z = sqrt(-2*log(u1))*cos(2*M_PI*u2);
+			if (t.ann1 && lcg_unif(state) < 0.05) t.z += 6;
+			t.q1 = -2 + 4*lcg_unif(state);
+			t.q1na = !plain && lcg_unif(state) < 0.05;
+			t.tssd = (int) (100000*lcg_unif(state));
+			snps.push_back(t);
+		}
+	}
+	return snps;
+}
+
+static void write_input(const string& file, const vector<TestSNP>& snps, bool segnumber = false){
+	// with segnumber, for -fine, a SEGNUMBER column puts every 50 SNPs in a segment
+	ogzstream out(file.c_str());
+	out.precision(17);
+	out << "SNPID CHR POS F Z N ann1 ann2 q1 tssd";
+	if (segnumber) out << " SEGNUMBER";
+	out << "\n";
+	for (int i = 0; i < snps.size(); i++){
+		const TestSNP& t = snps[i];
+		out << "rs"<< i << " "<< t.chr << " "<< t.pos << " "<< t.f << " "<< t.z << " 10000 "<< t.ann1 << " "<< t.ann2 << " ";
+		if (t.q1na) out << "NA";
+		else out << t.q1;
+		out << " "<< t.tssd;
+		if (segnumber) out << " "<< i/50;
+		out << "\n";
+	}
+	out.close();
+}
+
+static Fgwas_params test_params(const string& infile){
 	Fgwas_params p;
-	//p.wannot.push_back("wgEncodeDukeDnase8988T");
-	//p.wannot.push_back("wgEncodeDukeDnaseAoSMC");
-	//p.cc = false;
-	p.K = 5;
-	//p.finemap = false;
-	p.segment_bedfile = "/Users/jkpickrell/projects/GWAS/test.bed";
-	p.bedseg = true;
-	p.infile = "/Users/jkpickrell/projects/GWAS/t.gz";
-	string bedfile = "/Users/jkpickrell/projects/GWAS/test.bed";
+	p.infile = infile;
+	p.outstem = "fgwas_test";
+	p.K = 100;
+	return p;
+}
+
+// the generated SNP for each SNP of s
+static vector<const TestSNP*> match_snps(SNPs& s, const vector<TestSNP>& snps){
+	map<pair<string, int>, const TestSNP*> bypos;
+	for (int i = 0; i < snps.size(); i++) bypos[make_pair(snps[i].chr, snps[i].pos)] = &snps[i];
+	vector<const TestSNP*> toreturn;
+	for (int i = 0; i < s.d.size(); i++) toreturn.push_back(bypos[make_pair(s.chrname(i), s.d[i].pos)]);
+	return toreturn;
+}
+
+// bins of the distance model in the test, in file order (not sorted, and with a gap)
+static vector<pair<int, int> > test_dbins(){
+	vector<pair<int, int> > bins;
+	bins.push_back(make_pair(30000, 1000000));
+	bins.push_back(make_pair(0, 5000));
+	bins.push_back(make_pair(5000, 20000));
+	return bins;
+}
+
+static void write_dmodel(const string& file){
+	vector<pair<int, int> > bins = test_dbins();
+	ofstream out(file.c_str());
+	for (int i = 0; i < bins.size(); i++) out << bins[i].first << " "<< bins[i].second << "\n";
+	out.close();
+}
+
+static long double logsum(const vector<long double>& v){
+	long double m = v[0];
+	for (int i = 1; i < v.size(); i++) m = max(m, v[i]);
+	long double sum = 0;
+	for (int i = 0; i < v.size(); i++) sum += expl(v[i]-m);
+	return m + logl(sum);
+}
+
+static long double reference_x(SNPs& s, const TestSNP& t){
+	//
+	// x of a SNP at the current parameters of s, as the baseline computed it from the generated
+	// values: binary annotations by name, the test distance model, q1 through the thresholded
+	// logistic
+	//
+	int nbinary = s.nannot - s.ndistannot;
+	vector<pair<int, int> > dbins = test_dbins();
+	long double x = 0;
+	for (int j = 0; j < nbinary; j++){
+		if ((s.annotnames[j] == "ann1" && t.ann1) || (s.annotnames[j] == "ann2" && t.ann2)) x += s.lambdas[j];
+	}
+	for (int k = 0; k < dbins.size() && s.ndistannot > 0; k++){
+		if (t.tssd >= dbins[k].first && t.tssd < dbins[k].second) x += s.lambdas[nbinary+k];
+	}
+	for (int j = 0; j < s.quantparams.size(); j++){
+		if (t.q1na) continue;
+		const QuantParams& qp = s.quantparams[j];
+		double exponent = -qp.b1 * (t.q1 - qp.b0);
+		if (exponent < -4.59512) x += qp.lambda;
+		else if (exponent < 4.59512) x += qp.lambda / (1 + exp(exponent));
+	}
+	return x;
+}
+
+static long double reference_segllk(SNPs& s, const vector<const TestSNP*>& gen, int seg){
+	// ln(lk) of one segment at the current parameters of s, without segment annotations
+	vector<long double> x, xbf;
+	for (int i = s.segments[seg].first; i < s.segments[seg].second; i++){
+		long double xi = reference_x(s, *gen[i]);
+		x.push_back(xi);
+		xbf.push_back(xi + s.d[i].BF);
+	}
+	long double lsum = logsum(xbf) - logsum(x);
+	long double pi = s.segpi;
+	if (s.params->finemap) return lsum;
+	return logl(pi*expl(lsum) + 1 - pi);
+}
+
+static double reference_llk(SNPs& s, const vector<const TestSNP*>& gen){
+	// ln(lk) at the current parameters of s, one SNP at a time
+	long double total = 0;
+	for (int seg = 0; seg < s.segments.size(); seg++) total += reference_segllk(s, gen, seg);
+	return s.add_penalty(total, s.lambdas, s.quantparams, s.seglambdas, false);
+}
+
+// a few parameter points for the equivalence checks, from a fixed seed
+static void set_test_point(SNPs& s, int which){
+	unsigned long state = 1000 + which;
+	s.segpi = 0.001 + 0.3*lcg_unif(state);
+	for (int j = 0; j < s.lambdas.size(); j++) s.lambdas[j] = -2 + 6*lcg_unif(state);
+	for (int j = 0; j < s.quantparams.size(); j++){
+		s.quantparams[j].lambda = -2 + 4*lcg_unif(state);
+		s.quantparams[j].b0 = -1 + 2*lcg_unif(state);
+		s.quantparams[j].b1 = which == 0 ? 0.5 : -8 + 16*lcg_unif(state);
+	}
+	s.set_priors();
+}
+
+static void test_distbins(const vector<TestSNP>& snps){
+	// the binary search for the distance bin against a scan of the bins, and ln(lk) with a distance model
+	write_dmodel("fgwas_test.dmodel");
+	Fgwas_params p = test_params("fgwas_test.in.gz");
+	p.wannot.push_back("ann1");
+	p.dannot.push_back("tssd");
+	p.distmodels.push_back("fgwas_test.dmodel");
+	SNPs s(&p);
+	vector<pair<int, int> > bins = test_dbins();
+	bool binok = true;
+	for (int dist = -10; dist < 1000100 && binok; dist += (dist < 40000 ? 1 : 997)){
+		int expected = -1;
+		for (int k = 0; k < bins.size(); k++) if (dist >= bins[k].first && dist < bins[k].second) expected = k;
+		if (s.find_distbin(0, dist) != expected) binok = false;
+	}
+	check(binok, "distance bin lookup");
+	vector<const TestSNP*> gen = match_snps(s, snps);
+	for (int k = 0; k < 3; k++){
+		set_test_point(s, k);
+		check(near(s.llk(), reference_llk(s, gen), 1e-9), "ln(lk) with a distance model");
+	}
+	remove("fgwas_test.dmodel");
+}
+
+static void test_quant(const vector<TestSNP>& snps){
+	// x of each SNP from the bands along the sorted q1, and ln(lk), against the direct logistic
+	Fgwas_params p = test_params("fgwas_test.in.gz");
+	p.wannot.push_back("ann1");
+	p.quantannot.push_back("q1");
 	SNPs s(&p);
-	for (vector<pair<int, int> >::iterator it = s.segments.begin(); it != s.segments.end(); it++){
-		int st = it->first;
-		int sp = it->second;
-		cout << st << " "<< sp << "\n";
-		cout << s.d.at(st).chr << " "<< s.d.at(st).pos << " "<< s.d.at(sp-1).chr << " "<< s.d.at(sp-1).pos << "\n";
-	}
-	*/
-	//map<string, vector<pair<int, int> > > t = s.read_bedfile(bedfile);
-	//for (map<string, vector<pair<int, int> > >::iterator it = t.begin(); it != t.end(); it++){
-	//	for (vector<pair<int, int> >::iterator it2 = it->second.begin(); it2 != it->second.end(); it2++){
-	//		cout << it->first << " "<< it2->first << " "<< it2->second << "\n";
-	//	}
-	//}
-	//p.dannot.push_back("tssdist");
-	//p.segannot.push_back("tssdist");
-	//p.loquant = 0.33;
-	//p.hiquant = 0.67;
-	//p.distmodels.push_back("dist_model");
-	//string test = "1340.5";
-	//cout << atoi(test.c_str()); cout.flush();
-	//p.infile = "/Users/pickrell/Documents/workspace/GWAS/test/hb.wpos.wf.COMBINED.wdist.gz";
-	//p.infile = "/Users/pickrell/Documents/workspace/GWAS/test/hb_testin.gz";
-	//SNPs s(&p);
-	//s.GSL_optim();
-	//s.cross10(false);
-	//s.GSL_optim();
-	/*
-	for (int i = 0; i < s.segments.size(); i++){
-		pair<int, int> seg = s.segments[i];
-		int st = seg.first;
-		int sp = seg.second;
-		int sum  = 0;
-		int total = 0;
-		for (int j = st ;j < sp; j++){
-			sum+= s.d[j].dens;
-			total++;
-		}
-		double mean = (double) sum / (double) total;
-		cout << i << " "<< mean << " "<< s.d[st].pos << " "<< s.d[sp].pos << " "<< s.d[st].chr << "\n";
-
-	}
-	*/
-	//s.print_segments();
-	//s.GSL_optim();
-	//s.print("testout.bfs.gz");
+	vector<const TestSNP*> gen = match_snps(s, snps);
+	// b1 from the fixed points, then flat, sharp and sharp decreasing
+	double b1s[] = {0, 0, 0, 50, -50};
+	for (int k = 0; k < 5; k++){
+		set_test_point(s, k);
+		if (k > 1) s.quantparams[0].b1 = b1s[k];
+		s.set_snpx();
+		double maxdiff = 0;
+		for (int i = 0; i < s.d.size(); i++) maxdiff = max(maxdiff, (double) fabsl(s.snppri[i] - reference_x(s, *gen[i])));
+		check(maxdiff < 1e-12, "x of the SNPs with a quantitative annotation");
+		s.set_priors();
+		check(near(s.llk(), reference_llk(s, gen), 1e-9), "ln(lk) with a quantitative annotation");
+	}
+}
+
+static void test_qbins(const vector<TestSNP>& snps){
+	//
+	// -qbins: each SNP's code is its equal-width bin (the last code for NA) and the value of a
+	// code lies in its bin; ln(lk) is the exact one with each value replaced by its code's.
+	// 50 bins are stored in 8 bits, 300 in 16.
+	//
+	int nbins[] = {50, 300};
+	for (int b = 0; b < 2; b++){
+		Fgwas_params p = test_params("fgwas_test.in.gz");
+		p.wannot.push_back("ann1");
+		p.quantannot.push_back("q1");
+		p.qbins = nbins[b];
+		SNPs s(&p);
+		vector<const TestSNP*> gen = match_snps(s, snps);
+		check(s.useqbins && (b == 0 ? s.qcodes8.size() : s.qcodes16.size()) == 1, "-qbins code width");
+		double minq = 0, maxq = 0;
+		bool first = true;
+		for (int i = 0; i < s.d.size(); i++){
+			if (gen[i]->q1na) continue;
+			if (first || gen[i]->q1 < minq) minq = gen[i]->q1;
+			if (first || gen[i]->q1 > maxq) maxq = gen[i]->q1;
+			first = false;
+		}
+		double width = (maxq-minq) / nbins[b];
+		const vector<double>& vals = s.qcodevals[0];
+		bool codesok = vals.size() == nbins[b]+1;
+		vector<TestSNP> binned;
+		for (int i = 0; i < s.d.size() && codesok; i++){
+			int code = b == 0 ? s.qcodes8[0][i] : s.qcodes16[0][i];
+			binned.push_back(*gen[i]);
+			if (gen[i]->q1na){
+				codesok = code == nbins[b];
+				continue;
+			}
+			double lo = minq + code*width - 1e-9, hi = minq + (code+1)*width + 1e-9;
+			codesok = code < nbins[b] && gen[i]->q1 >= lo && gen[i]->q1 <= hi && vals[code] >= lo && vals[code] <= hi;
+			binned.back().q1 = vals[code];
+		}
+		check(codesok, "-qbins codes and code values");
+		if (!codesok) continue;
+		vector<const TestSNP*> bgen;
+		for (int i = 0; i < binned.size(); i++) bgen.push_back(&binned[i]);
+		for (int k = 0; k < 3; k++){
+			set_test_point(s, k);
+			check(near(s.llk(), reference_llk(s, bgen), 1e-9), "ln(lk) with -qbins");
+		}
+	}
+}
+
+static void test_kernels(const vector<TestSNP>& snps){
+	//
+	// the x kernel picked for each count of binary and distance annotations against the general
+	// one, and ln(lk) against the direct computation, also when fine-mapping
+	//
+	write_dmodel("fgwas_test.dmodel");
+	write_input("fgwas_test.fine.gz", snps, true);
+	for (int m = 0; m < 6; m++){
+		int nbinary = m % 3;
+		bool dist = m >= 3;
+		if (nbinary == 0 && !dist) continue;
+		for (int fine = 0; fine < 2; fine++){
+			Fgwas_params p = test_params(fine ? "fgwas_test.fine.gz" : "fgwas_test.in.gz");
+			p.finemap = fine;
+			if (nbinary > 0) p.wannot.push_back("ann1");
+			if (nbinary > 1) p.wannot.push_back("ann2");
+			if (dist){
+				p.dannot.push_back("tssd");
+				p.distmodels.push_back("fgwas_test.dmodel");
+			}
+			SNPs s(&p);
+			vector<const TestSNP*> gen = match_snps(s, snps);
+			check(s.snpx_fn != &SNPs::snpx_kernel<-1, -1>, "a specialized x kernel is picked");
+			for (int k = 0; k < 2; k++){
+				set_test_point(s, k);
+				vector<double> x;
+				s.set_snpx();
+				x = s.snppri;
+				s.snpx_fn = &SNPs::snpx_kernel<-1, -1>;
+				s.set_snpx();
+				check(x == s.snppri, "specialized x kernel against the general one");
+				s.choose_kernels();
+				s.set_priors();
+				check(near(s.llk(), reference_llk(s, gen), 1e-9), fine ? "ln(lk) from the fine-mapping kernel" : "ln(lk) from the kernels");
+			}
+		}
+	}
+	remove("fgwas_test.dmodel");
+	remove("fgwas_test.fine.gz");
+}
 
+static void test_batch(){
+	//
+	// llk_batch against set_point, set_priors and llk for each point, with SNPs, with -qbins
+	// tables, with segments skipped and the ridge penalty, and with its buffers reused for fewer
+	// points; and the one-parameter form
+	//
+	for (int qb = 0; qb < 2; qb++){
+		Fgwas_params p = test_params("fgwas_test.in.gz");
+		p.wannot.push_back("ann1");
+		p.wannot.push_back("ann2");
+		p.quantannot.push_back("q1");
+		if (qb) p.qbins = 100;
+		p.ridge_penalty = 0.2;
+		SNPs s(&p);
+		vector<ModelPoint> points;
+		for (int k = 0; k < 4; k++){
+			set_test_point(s, k);
+			points.push_back(s.get_point());
+		}
+		set<int> skip;
+		skip.insert(3);
+		skip.insert(17);
+		BatchScratch scratch;
+		for (int pass = 0; pass < 2; pass++){
+			int K = pass == 0 ? 4 : 2;
+			bool penalize = pass == 1;
+			vector<double> lks = s.llk_batch(&points[4-K], K, pass == 0 ? s.noskip : skip, penalize, false, scratch);
+			bool ok = lks.size() == K;
+			for (int k = 0; k < K && ok; k++){
+				s.set_point(points[4-K+k]);
+				s.set_priors();
+				ok = near(lks[k], s.llk(pass == 0 ? set<int>() : skip, penalize), 1e-10);
+			}
+			check(ok, qb ? "llk_batch with -qbins against llk" : "llk_batch against llk");
+		}
+		vector<double> vals;
+		vals.push_back(-1);
+		vals.push_back(0.5);
+		vals.push_back(2);
+		vector<double> lks = s.llk_batch(&s.lambdas[1], vals);
+		bool ok = true;
+		for (int i = 0; i < vals.size(); i++){
+			s.lambdas[1] = vals[i];
+			s.set_priors();
+			ok = ok && near(lks[i], s.llk(), 1e-10);
+		}
+		check(ok, "llk_batch over the values of one parameter");
+	}
+}
+
+static double quadratic(const vector<double>& x){
+	// minimum 1 at (1, -2, 0.5, 3), with the axes mixed
+	double c[] = {1, -2, 0.5, 3};
+	double f = 1;
+	for (int i = 0; i < 4; i++) f += (i+1)*(x[i]-c[i])*(x[i]-c[i]);
+	return f + (x[0]-c[0])*(x[1]-c[1]);
+}
+
+static void nm_run(NMSimplex& nm, int maxiter){
+	// ask and tell until done, or until iteration maxiter is complete
+	vector<double> fvals;
+	while (!nm.done){
+		fvals.resize(nm.ask.size());
+		for (int i = 0; i < nm.ask.size(); i++) fvals[i] = quadratic(nm.asked(i));
+		nm.tell(fvals);
+		if (!nm.iterated) continue;
+		if (nm.iter >= maxiter) return;
+		nm.next();
+	}
+}
+
+static void test_nmsimplex(){
+	// Nelder-Mead finds the minimum of a quadratic, and a run saved and restored part way ends the same
+	Fgwas_params p;
+	p.optim_tol = 1e-7;
+	p.plateau_iter = 0;
+	vector<double> x0(4, 0.0), step(4, 1.0);
+	NMSimplex a(x0, step, &p);
+	nm_run(a, p.optim_maxiter);
+	double c[] = {1, -2, 0.5, 3};
+	bool atmin = a.converged;
+	for (int i = 0; i < 4; i++) atmin = atmin && fabs(a.simplex[a.best][i] - c[i]) < 1e-4;
+	check(atmin && fabs(a.f[a.best] - 1) < 1e-8, "Nelder-Mead minimum of a quadratic");
+
+	NMSimplex b(x0, step, &p);
+	nm_run(b, 15);
+	vector<double> state;
+	b.save(state);
+	NMSimplex resumed(x0, step, &p);
+	int pos = 0;
+	check(resumed.restore(state, pos) && pos == state.size(), "Nelder-Mead state restored");
+	resumed.next();
+	nm_run(resumed, p.optim_maxiter);
+	check(resumed.iter == a.iter && resumed.simplex == a.simplex && resumed.f == a.f, "Nelder-Mead run continued from a saved state");
+	vector<double> cut(state.begin(), state.end()-3);
+	NMSimplex d(x0, step, &p);
+	pos = 0;
+	check(!d.restore(cut, pos), "Nelder-Mead state cut short is refused");
+}
+
+static double llk_at(SNPs& s, const vector<double>& x, bool penalize = false){
+	ModelPoint pt = s.get_point();
+	s.set_x(x, pt);
+	s.set_point(pt);
+	s.set_priors();
+	return s.llk(set<int>(), penalize);
+}
+
+static void test_em(){
+	//
+	// solve_pd on a random positive definite system and its refusal of one that is not; em_pass:
+	// the ln(lk) it returns is that at x, its update is an ascent direction, and after a penalized
+	// EM fit has converged the update stays put and the gradient is 0
+	//
+	unsigned long state = 7;
+	int n = 5;
+	vector<double> B(n*n), A(n*n, 0.0), b(n), x;
+	for (int i = 0; i < n*n; i++) B[i] = -1 + 2*lcg_unif(state);
+	for (int i = 0; i < n; i++) b[i] = -1 + 2*lcg_unif(state);
+	for (int i = 0; i < n; i++){
+		for (int j = 0; j < n; j++){
+			for (int k = 0; k < n; k++) A[i*n+j] += B[k*n+i]*B[k*n+j];
+		}
+		A[i*n+i] += 0.1;
+	}
+	bool ok = SNPs::solve_pd(A, b, n, x);
+	for (int i = 0; i < n && ok; i++){
+		double ax = 0;
+		for (int j = 0; j < n; j++) ax += A[i*n+j]*x[j];
+		ok = near(ax, b[i], 1e-10);
+	}
+	check(ok, "solve_pd solves a positive definite system");
+	A[2*n+2] = -1;
+	check(!SNPs::solve_pd(A, b, n, x), "solve_pd rejects a matrix that is not positive definite");
+
+	Fgwas_params p = test_params("fgwas_test.in.gz");
+	p.wannot.push_back("ann1");
+	p.wannot.push_back("ann2");
+	p.optimizer = "em";
+	p.optim_tol = 1e-6;
+	p.ridge_penalty = 0.2;
+	SNPs s(&p);
+	set<int> skip;
+	for (int k = 0; k < 3; k++){
+		set_test_point(s, k);
+		ModelPoint pt = s.get_point();
+		vector<double> next, xa;
+		s.get_x(pt, x);
+		double l = s.em_pass(x, skip, false, next);
+		check(near(l, llk_at(s, x), 1e-9), "em_pass ln(lk) against llk");
+		xa = x;
+		for (int j = 0; j < x.size(); j++) xa[j] += 1e-4*(next[j]-x[j]);
+		check(llk_at(s, xa) > l, "em_pass update is an ascent direction");
+	}
+	// with the ridge penalty the optimum is finite
+	s.EM_optim(skip, true);
+	ModelPoint pt = s.get_point();
+	vector<double> next;
+	s.get_x(pt, x);
+	s.em_pass(x, skip, true, next);
+	double size = 0;
+	for (int j = 0; j < x.size(); j++) size = max(size, fabs(next[j]-x[j]));
+	check(size < 1e-4, "em_pass update at the EM optimum");
+	double grad = 0;
+	for (int j = 0; j < x.size(); j++){
+		vector<double> xp = x, xm = x;
+		xp[j] += 1e-4;
+		xm[j] -= 1e-4;
+		grad = max(grad, fabs(llk_at(s, xp, true) - llk_at(s, xm, true)) / 2e-4);
+	}
+	check(grad < 1e-2, "gradient of ln(lk) at the EM optimum");
+}
+
+static void test_patterns(const vector<TestSNP>& snps){
+	//
+	// the annotation pattern table: each segment's units hold its SNPs and their summed BF, and
+	// ln(lk) and the EM update over the units match those over the SNPs and the direct ln(lk)
+	//
+	write_dmodel("fgwas_test.dmodel");
+	for (int dist = 0; dist < 2; dist++){
+		Fgwas_params p = test_params("fgwas_test.in.gz");
+		p.wannot.push_back("ann1");
+		p.wannot.push_back("ann2");
+		if (dist){
+			p.dannot.push_back("tssd");
+			p.distmodels.push_back("fgwas_test.dmodel");
+		}
+		SNPs s(&p);
+		vector<const TestSNP*> gen = match_snps(s, snps);
+		check(s.usepatterns, "annotation patterns are used");
+		if (!s.usepatterns) continue;
+		bool ok = true;
+		for (int seg = 0; seg < s.segments.size() && ok; seg++){
+			long double n = 0, bf = 0, snpbf = 0;
+			for (int u = s.segpatst[seg]; u < s.segpatst[seg+1]; u++){
+				n += expl(s.patlogn[u]);
+				bf += expl(s.patlogn[u] + s.patbf[u]);
+				ok = ok && s.patsnp[u] >= s.segments[seg].first && s.patsnp[u] < s.segments[seg].second;
+			}
+			for (int i = s.segments[seg].first; i < s.segments[seg].second; i++) snpbf += expl(s.d[i].BF);
+			ok = ok && near(n, s.segments[seg].second - s.segments[seg].first, 1e-9) && near(logl(bf), logl(snpbf), 1e-9);
+		}
+		check(ok, "annotation patterns cover the SNPs of their segment");
+		vector<char> invariant = s.seginvariant;
+		set<int> skip;
+		for (int k = 0; k < 3; k++){
+			set_test_point(s, k);
+			ModelPoint pt = s.get_point();
+			double ref = reference_llk(s, gen);
+			vector<double> x, next, snpnext;
+			s.get_x(pt, x);
+			double l = s.llk_batch(&pt, 1, s.noskip, false, false, s.batch)[0];
+			double le = s.em_pass(x, skip, false, next);
+			s.seginvariant.assign(invariant.size(), 0);
+			double lnoinv = s.llk_batch(&pt, 1, s.noskip, false, false, s.batch)[0];
+			s.usepatterns = false;
+			double lsnp = s.llk_batch(&pt, 1, s.noskip, false, false, s.batch)[0];
+			double lesnp = s.em_pass(x, skip, false, snpnext);
+			s.usepatterns = true;
+			s.seginvariant = invariant;
+			check(near(l, ref, 1e-9) && near(lnoinv, ref, 1e-9) && near(lsnp, ref, 1e-9), "ln(lk) over annotation patterns");
+			ok = near(le, lesnp, 1e-9);
+			for (int j = 0; j < x.size(); j++) ok = ok && near(next[j], snpnext[j], 1e-9);
+			check(ok, "em_pass over annotation patterns");
+		}
+	}
+	remove("fgwas_test.dmodel");
+}
+
+static void test_seginvariant(const vector<TestSNP>& snps){
+	//
+	// segments are flagged exactly when all their SNPs have the same annotations (the first 300
+	// SNPs of chr2 have none), and the cached ln(lk) of a flagged segment is the direct one, also
+	// when fine-mapping
+	//
+	write_input("fgwas_test.fine.gz", snps, true);
+	for (int fine = 0; fine < 2; fine++){
+		Fgwas_params p = test_params(fine ? "fgwas_test.fine.gz" : "fgwas_test.in.gz");
+		p.finemap = fine;
+		p.wannot.push_back("ann1");
+		p.wannot.push_back("ann2");
+		SNPs s(&p);
+		vector<const TestSNP*> gen = match_snps(s, snps);
+		bool ok = s.seginvariant.size() == s.segments.size();
+		int nflagged = 0;
+		for (int seg = 0; seg < s.segments.size() && ok; seg++){
+			const TestSNP* first = gen[s.segments[seg].first];
+			bool same = true;
+			for (int i = s.segments[seg].first; i < s.segments[seg].second; i++) same = same && gen[i]->ann1 == first->ann1 && gen[i]->ann2 == first->ann2;
+			ok = (s.seginvariant[seg] != 0) == same;
+			nflagged += s.seginvariant[seg];
+		}
+		check(ok && nflagged >= 3, "segments with one annotation pattern are flagged");
+		for (int k = 0; k < 3; k++){
+			set_test_point(s, k);
+			ok = true;
+			for (int seg = 0; seg < s.segments.size(); seg++){
+				if (!s.seginvariant[seg]) continue;
+				double ref = reference_segllk(s, gen, seg);
+				ok = ok && near(s.invariant_llk(seg, s.segpriors[seg]), ref, 1e-10) && near(s.llk(seg), ref, 1e-10);
+			}
+			check(ok, "ln(lk) of the segments with one annotation pattern");
+		}
+	}
+	remove("fgwas_test.fine.gz");
+}
+
+static void test_prune(const vector<TestSNP>& snps){
+	//
+	// -prune: at points within its bound the grouped ln(lk) of each segment is within eps of the
+	// exact one, and at points outside it llk_batch falls back to the exact ln(lk)
+	//
+	Fgwas_params p = test_params("fgwas_test.in.gz");
+	p.wannot.push_back("ann1");
+	p.quantannot.push_back("q1");
+	p.prune_eps = 0.5;
+	p.prune_slope = 0.5;
+	SNPs s(&p);
+	vector<const TestSNP*> gen = match_snps(s, snps);
+	check(s.pruned && s.usepatterns, "-prune groups the SNPs");
+	if (!s.pruned) return;
+	unsigned long state = 11;
+	for (int k = 0; k < 8; k++){
+		set_test_point(s, k);
+		// slopes up to 0.45 are within the bound for |lambda| <= 2, 2 is outside
+		double slope = k < 6 ? 0.45*lcg_unif(state) : 2;
+		s.quantparams[0].b1 = 4*slope / fabs(s.quantparams[0].lambda);
+		if (k % 2) s.quantparams[0].b1 = -s.quantparams[0].b1;
+		ModelPoint pt = s.get_point();
+		bool within = s.within_prune_bound(pt);
+		check(within == (k < 6), "-prune slope bound");
+		double maxerr = 0;
+		for (int seg = 0; seg < s.segments.size(); seg++){
+			set<int> skip;
+			for (int i = 0; i < s.segments.size(); i++) if (i != seg) skip.insert(i);
+			double grouped = s.llk_batch(&pt, 1, skip, false, true, s.batch)[0];
+			double exact = s.llk_batch(&pt, 1, skip, false, false, s.batch)[0];
+			maxerr = max(maxerr, fabs(grouped-exact));
+		}
+		if (within) check(maxerr > 0 && maxerr <= p.prune_eps, "-prune ln(lk) of each segment within eps");
+		else check(maxerr == 0, "ln(lk) outside the -prune bound is exact");
+		if (!within) continue;
+		// x of each SNP within eps/2 of that of its group: the unit of its segment with its
+		// annotation and its value of q1, or its q1 cell
+		double w = p.prune_eps / p.prune_slope;
+		vector<vector<double> > notables;
+		bool ok = true;
+		for (int seg = 0; seg < s.segments.size() && ok; seg++){
+			for (int i = s.segments[seg].first; i < s.segments[seg].second && ok; i++){
+				const TestSNP& t = *gen[i];
+				double xi = reference_x(s, t);
+				ok = false;
+				for (int u = s.segpatst[seg]; u < s.segpatst[seg+1] && !ok; u++){
+					double q = s.patq[u];
+					if (gen[s.patsnp[u]]->ann1 != t.ann1 || isnan(q) != t.q1na) continue;
+					if (!t.q1na && q != t.q1 && floor(q / w) != floor(t.q1 / w)) continue;
+					ok = fabs(s.unit_x(u, pt, notables, true) - s.patlogn[u] - xi) <= p.prune_eps/2;
+				}
+			}
+		}
+		check(ok, "-prune x of each SNP within eps/2 of its group's");
+	}
+}
+
+static bool resume_fails(Fgwas_params* p, const map<string, string>& run){
+	// whether resuming from the checkpoint ends the process with an error
+	cout.flush();
+	pid_t pid = fork();
+	if (pid == 0){
+		freopen("/dev/null", "w", stderr);
+		freopen("/dev/null", "w", stdout);
+		Checkpoint c;
+		c.init(p, run);
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) && WEXITSTATUS(status) == 1;
+}
+
+static void damage_checkpoint(const string& file, const string& good, size_t pos, const string& bytes, size_t cut){
+	// the checkpoint good with bytes written at pos, and cut bytes dropped from its end
+	string buf = good;
+	buf.replace(pos, bytes.size(), bytes);
+	buf.resize(buf.size()-cut);
+	ofstream out(file.c_str(), ios::binary);
+	out.write(buf.data(), buf.size());
+}
+
+static void test_checkpoint(){
+	//
+	// the saved vectors read back bit for bit on -resume; a checkpoint from a run with a different
+	// description, or with a damaged header, entry type, name length or count, is an error
+	//
+	Fgwas_params p = test_params("fgwas_test.in.gz");
+	p.checkpoint_sec = 3600;
+	map<string, string> run;
+	run["model"] = "ann1+ann2";
+	run["data"] = "fgwas_test.in.gz 4000 \xc3\xa9";
+	vector<double> v1, v2;
+	v1.push_back(1.5);
+	v1.push_back(-1.0/3);
+	v1.push_back(1e-300);
+	v1.push_back(numeric_limits<double>::infinity());
+	Checkpoint a;
+	a.init(&p, run);
+	a.put("run:phase1", v1);
+	a.put("phase0", v2);
+	a.put("gone", v1);
+	a.erase("gone");
+	a.put("phase0", v2);
+
+	p.resume = true;
+	Checkpoint b;
+	b.init(&p, run);
+	check(b.has("run:phase1") && b.has("phase0") && !b.has("gone") && !b.has("run:model"), "checkpoint entries after -resume");
+	check(b.get("run:phase1").size() == v1.size() && memcmp(&b.get("run:phase1")[0], &v1[0], v1.size()*sizeof(double)) == 0, "checkpoint values after -resume");
+	check(b.get("phase0").empty(), "empty checkpoint entry after -resume");
+
+	map<string, string> other = run;
+	other["model"] = "ann1";
+	check(resume_fails(&p, other), "-resume of a run with a different model");
+	other = run;
+	other["pi"] = "0.1";
+	check(resume_fails(&p, other), "-resume of a run with a description the checkpoint lacks");
+	check(!resume_fails(&p, run), "-resume of the same run");
+
+	string file = p.outstem+".ckpt";
+	ifstream in(file.c_str(), ios::binary);
+	string good((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	in.close();
+	// the magic string, the entry count, then the first entry ('s' "run:data") at 12
+	int big = 1 << 30, neg = -5;
+	string sbig((char*) &big, sizeof(int)), sneg((char*) &neg, sizeof(int));
+	damage_checkpoint(file, good, 0, "FGWASCK1", 0);
+	check(resume_fails(&p, run), "checkpoint of another version");
+	damage_checkpoint(file, good, 8, sneg, 0);
+	check(resume_fails(&p, run), "checkpoint with a negative entry count");
+	damage_checkpoint(file, good, 12, "x", 0);
+	check(resume_fails(&p, run), "checkpoint with a bad entry type");
+	damage_checkpoint(file, good, 13, sneg, 0);
+	check(resume_fails(&p, run), "checkpoint with a negative name length");
+	damage_checkpoint(file, good, 13, sbig, 0);
+	check(resume_fails(&p, run), "checkpoint with a huge name length");
+	damage_checkpoint(file, good, 17+8, sbig, 0);
+	check(resume_fails(&p, run), "checkpoint with a count beyond the end of the file");
+	damage_checkpoint(file, good, 0, "", 5);
+	check(resume_fails(&p, run), "truncated checkpoint");
+	damage_checkpoint(file, good, 0, "", 0);
+	check(!resume_fails(&p, run), "checkpoint rewritten unchanged");
+	remove(file.c_str());
+}
+
+static void test_init(){
+	//
+	// -init: values by name from both .params formats, first steps from the CIs (a quarter of
+	// the CI, in [0.01, 1]; pi's on the logit scale) or 10% of the value without one, and the
+	// parameters not in the file as without -init
+	//
+	Fgwas_params p = test_params("fgwas_test.in.gz");
+	p.segannot.push_back("ann2");
+	p.wannot.push_back("ann1");
+	p.quantannot.push_back("q1");
+	SNPs s(&p);
+	vector<double> x0, step0;
+	s.start_x(x0, step0);
+	check(x0.size() == 7, "parameters of the -init model");
+	if (x0.size() != 7) return;
+	ofstream out("fgwas_test.params");
+	out << "parameter CI_lo estimate CI_hi\n";
+	out << "pi_region 0.1 0.2 0.3\n";
+	out << "ann2_lo_ln fail 0.5 fail\n";
+	out << "ann1_ln -1 1.5 7\n";
+	out << "QuantParam CI_lo estimate CI_hi b0 b1\n";
+	out << "q1_ln 0.99 1 1.02 0.3 -20\n";
+	out.close();
+	s.read_init("fgwas_test.params");
+	// pi_region, ann2_lo, ann2_hi (not in the file), ann1, then lambda, b0 and b1 of q1
+	double x[] = {log(0.2/0.8), 0.5, x0[2], 1.5, 1, 0.3, -20};
+	double step[] = {(log(0.3/0.7) - log(0.1/0.9))/4, 0.1, step0[2], 1, 0.01, 0.1, 2};
+	bool ok = s.init_x.size() == 7 && s.init_step.size() == 7;
+	for (int i = 0; i < 7 && ok; i++) ok = near(s.init_x[i], x[i], 1e-12) && near(s.init_step[i], step[i], 1e-12);
+	check(ok, "-init values and steps from a .params");
+	vector<double> sx, sstep;
+	s.start_x(sx, sstep);
+	check(sx == s.init_x && sstep == s.init_step, "optimizers start from -init");
+
+	out.open("fgwas_test.params");
+	out << "pi 0.2\n";
+	out << "ann1 1.5\n";
+	out << "QuantParam lambda b0 b1\n";
+	out.close();
+	s.read_init("fgwas_test.params");
+	double x2[] = {log(0.2/0.8), x0[1], x0[2], 1.5, x0[4], x0[5], x0[6]};
+	double step2[] = {0.5, step0[1], step0[2], 0.15, step0[4], step0[5], step0[6]};
+	ok = s.init_x.size() == 7 && s.init_step.size() == 7;
+	for (int i = 0; i < 7 && ok; i++) ok = near(s.init_x[i], x2[i], 1e-12) && near(s.init_step[i], step2[i], 1e-12);
+	check(ok, "-init values and steps from an old-format .params without CIs");
+	remove("fgwas_test.params");
+}
+
+static void test_wbed(const vector<TestSNP>& snps){
+	// -wbed against a direct check of every SNP against every region
+	string bed = "fgwas_test.bed";
+	vector<pair<string, pair<int, int> > > regions;
+	regions.push_back(make_pair(string("chr1"), make_pair(snps[10].pos-1, snps[12].pos))); // first and last SNP inside
+	regions.push_back(make_pair(string("chr1"), make_pair(snps[20].pos, snps[25].pos-1))); // neither end inside
+	regions.push_back(make_pair(string("chr1"), make_pair(snps[400].pos-1, snps[400].pos)));
+	regions.push_back(make_pair(string("chr2"), make_pair(snps[2500].pos+1, snps[2900].pos)));
+	regions.push_back(make_pair(string("chr3"), make_pair(0, 100000)));
+	ofstream out(bed.c_str());
+	for (int i = 0; i < regions.size(); i++) out << regions[i].first << "\t"<< regions[i].second.first << "\t"<< regions[i].second.second << "\n";
+	out.close();
+
+	Fgwas_params p = test_params("fgwas_test.in.gz");
+	p.wannot.push_back("ann1");
+	p.bedannot.push_back("enh");
+	p.bedannotfiles.push_back(bed);
+	SNPs s(&p);
+	vector<const TestSNP*> gen = match_snps(s, snps);
+	int nbad = 0, nin = 0;
+	for (int i = 0; i < s.d.size(); i++){
+		bool in = false;
+		for (int r = 0; r < regions.size(); r++){
+			if (regions[r].first == gen[i]->chr && regions[r].second.first < gen[i]->pos && gen[i]->pos <= regions[r].second.second) in = true;
+		}
+		if (in) nin++;
+		if (s.get_annot(i, 1) != in || s.get_annot(i, 0) != (bool) gen[i]->ann1) nbad++;
+	}
+	check(s.annotnames.size() == 2 && s.annotnames[1] == "enh", "-wbed annotation name");
+	check(nin > 400 && nbad == 0, "-wbed annotation of the SNPs in the regions");
+	remove(bed.c_str());
+}
+
+static string gzip_block(const string& text){
+	// one gzip member, as a block of a bgzipped file
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
+	vector<unsigned char> out(deflateBound(&zs, text.size()) + 64);
+	zs.next_in = (Bytef*) text.data();
+	zs.avail_in = text.size();
+	zs.next_out = &out[0];
+	zs.avail_out = out.size();
+	deflate(&zs, Z_FINISH);
+	string toreturn((char*) &out[0], out.size() - zs.avail_out);
+	deflateEnd(&zs);
+	return toreturn;
+}
+
+static void put_int32(string& buf, int32_t v){
+	buf.append((char*) &v, 4);
+}
+
+static void put_uint64(string& buf, uint64_t v){
+	buf.append((char*) &v, 8);
+}
+
+static int reg2bin(int beg, int end){
+	// the smallest bin holding [beg, end), as in the SAM specification
+	end--;
+	if (beg>>14 == end>>14) return ((1<<15)-1)/7 + (beg>>14);
+	if (beg>>17 == end>>17) return ((1<<12)-1)/7 + (beg>>17);
+	if (beg>>20 == end>>20) return ((1<<9)-1)/7 + (beg>>20);
+	if (beg>>23 == end>>23) return ((1<<6)-1)/7 + (beg>>23);
+	if (beg>>26 == end>>26) return ((1<<3)-1)/7 + (beg>>26);
 	return 0;
 }
 
+static void test_tabix(){
+	//
+	// a bgzipped file of chromosome and position in blocks of 40 lines and its .tbi, made here,
+	// read by region through the index and without it
+	//
+	string file = "fgwas_test.tab.gz";
+	const char* chrs[] = {"chr1", "chr2"};
+	vector<pair<int, int> > recs; // chromosome, position
+	unsigned long state = 7;
+	for (int c = 0; c < 2; c++){
+		int pos = 1;
+		for (int i = 0; i < 1000; i++){
+			pos += 1 + (int) (2000*lcg_unif(state));
+			recs.push_back(make_pair(c, pos));
+		}
+	}
+	string data;
+	string block = "#chr\tpos\n";
+	vector<uint64_t> voff; // of each record, and one past the last
+	for (int i = 0; i <= recs.size(); i++){
+		if (i == recs.size() || (i > 0 && i % 40 == 0)){
+			data += gzip_block(block);
+			block.clear();
+		}
+		voff.push_back(((uint64_t) data.size() << 16) | block.size());
+		if (i == recs.size()) break;
+		ostringstream line;
+		line << chrs[recs[i].first] << "\t"<< recs[i].second << "\n";
+		block += line.str();
+	}
+	ofstream out(file.c_str(), ios::binary);
+	out << data;
+	out.close();
+
+	string idx("TBI\1", 4);
+	put_int32(idx, 2);
+	int head[] = {0, 0, 1, 0, '#', 0};
+	for (int i = 0; i < 6; i++) put_int32(idx, head[i]);
+	put_int32(idx, 10);
+	idx.append("chr1\0chr2\0", 10);
+	for (int c = 0; c < 2; c++){
+		map<int, vector<pair<uint64_t, uint64_t> > > bins;
+		vector<uint64_t> linear;
+		for (int i = 0; i < recs.size(); i++){
+			if (recs[i].first != c) continue;
+			int beg = recs[i].second-1;
+			vector<pair<uint64_t, uint64_t> >& chunks = bins[reg2bin(beg, beg+1)];
+			if (chunks.size() > 0 && chunks.back().second == voff[i]) chunks.back().second = voff[i+1];
+			else chunks.push_back(make_pair(voff[i], voff[i+1]));
+			while (linear.size() <= (beg >> 14)) linear.push_back(voff[i]);
+		}
+		put_int32(idx, bins.size());
+		for (map<int, vector<pair<uint64_t, uint64_t> > >::iterator it = bins.begin(); it != bins.end(); it++){
+			put_int32(idx, it->first);
+			put_int32(idx, it->second.size());
+			for (int k = 0; k < it->second.size(); k++){
+				put_uint64(idx, it->second[k].first);
+				put_uint64(idx, it->second[k].second);
+			}
+		}
+		put_int32(idx, linear.size());
+		for (int k = 0; k < linear.size(); k++) put_uint64(idx, linear[k]);
+	}
+	ofstream iout((file+".tbi").c_str(), ios::binary);
+	iout << gzip_block(idx);
+	iout.close();
+
+	TabixIndex ti;
+	check(ti.load(file+".tbi") && ti.names.size() == 2 && ti.get_tid("chr2") == 1 && ti.get_tid("chr3") == -1, "tabix index header");
+
+	// reg2bins: every bin returned overlaps the range, and the bin of each position in it is there
+	bool binsok = true;
+	for (int t = 0; t < 200 && binsok; t++){
+		int64_t beg = (int64_t) (3e8*lcg_unif(state));
+		int64_t end = beg + 1 + (int64_t) (pow(10, 7*lcg_unif(state)));
+		vector<unsigned int> found;
+		ti.reg2bins(beg, end, found);
+		set<unsigned int> in(found.begin(), found.end());
+		for (int k = 0; k < 20; k++){
+			int x = beg + (int64_t) ((end-beg)*lcg_unif(state));
+			if (in.find(reg2bin(x, x+1)) == in.end()) binsok = false;
+		}
+		for (int k = 0; k < found.size(); k++){
+			int level = 0;
+			unsigned int first = 0;
+			while (level < 5 && found[k] >= first + (1u << 3*level)) first += 1u << 3*level++;
+			int64_t width = (int64_t) 1 << (29 - 3*level);
+			int64_t st = (found[k]-first) * width;
+			if (st >= end || st + width <= beg) binsok = false;
+		}
+	}
+	check(binsok, "tabix reg2bins");
+
+	// query: an offset at or before the first record in the region
+	bool queryok = true;
+	for (int i = 0; i < recs.size(); i += 97){
+		uint64_t v;
+		bool found = ti.query(recs[i].first, recs[i].second, recs[i].second + 5000, v);
+		if (!found || v > voff[i]) queryok = false;
+	}
+	check(queryok, "tabix query");
+
+	vector<string> regions;
+	regions.push_back("chr2:200000-400000");
+	regions.push_back("chr1:5000-90000");
+	regions.push_back("chr1:80000-120000");
+	vector<string> expected;
+	for (int i = 0; i < recs.size(); i++){
+		int pos = recs[i].second;
+		if ((recs[i].first == 1 && pos >= 200000 && pos <= 400000) || (recs[i].first == 0 && pos >= 5000 && pos <= 120000)){
+			ostringstream line;
+			line << chrs[recs[i].first] << "\t"<< pos;
+			expected.push_back(line.str());
+		}
+	}
+	for (int pass = 0; pass < 2; pass++){
+		// through the index, then the whole file
+		if (pass == 1) remove((file+".tbi").c_str());
+		TabixReader reader;
+		reader.open(file, regions, 0, 1);
+		vector<string> lines;
+		string line;
+		while (reader.getline(line)) lines.push_back(line);
+		reader.close();
+		check(reader.indexed == (pass == 0), "tabix index found");
+		check(lines == expected, pass == 0 ? "tabix regions read through the index" : "tabix regions read without the index");
+	}
+	remove(file.c_str());
+}
+
+int main(){
+	vector<TestSNP> snps = make_snps(2000, 1);
+	write_input("fgwas_test.in.gz", snps);
+
+	test_wbed(snps);
+	test_tabix();
+	test_distbins(snps);
+	test_quant(snps);
+	test_qbins(snps);
+	test_kernels(snps);
+	test_batch();
+	test_nmsimplex();
+	test_em();
+	test_patterns(snps);
+	test_seginvariant(snps);
+	test_prune(snps);
+	test_checkpoint();
+	test_init();
+
+	remove("fgwas_test.in.gz");
+	if (nfail > 0) cerr << nfail << " check(s) failed\n";
+	else cerr << "all checks passed\n";
+	return nfail;
+}